@@ -0,0 +1,151 @@
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <the_game.hpp>
+#include <thread_pool.hpp>
+
+// Plays lots of games with a bot and sums up how they went, to see what a
+// change to the level settings does.
+//
+//   bilebio_batch [games] [first seed] [max turns]
+//
+// Game i is seeded with first seed + i, so any one of them can be replayed.
+// Games run side by side on a thread pool, each on one thread. Games whose
+// level starts out without any plants (every root landed in line with the
+// player) are counted but left out of the rest of the summary.
+
+struct game_result
+{
+    size_t turns;
+    size_t spawned;
+    size_t plants_killed;
+    bool empty;
+    bool died;
+    double seconds;
+};
+
+// The player only ever moves straight up, down, left or right.
+static const int moves[4][2] = {{0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+
+// Walks the shortest path to the closest plant and hits it. Wanders when
+// there's none, or it can't be reached.
+static turn_action bot_turn(the_game &game, rng &r)
+{
+    auto at = game.player_coord();
+    const plant_store &plants = game.get_plants();
+
+    int best = -1;
+    std::pair<int, int> goal;
+    for (int type = pt_none + 1; type < pt_count; ++type)
+    {
+        for (auto pl : plants.get_all(static_cast<plant_type>(type)))
+        {
+            std::pair<int, int> v;
+            if (!game.get_entity_coord(pl, v))
+                continue;
+            int d = std::abs(v.first - at.first) + std::abs(v.second - at.second);
+            if (best < 0 || d < best)
+            {
+                best = d;
+                goal = v;
+            }
+        }
+    }
+
+    if (best >= 0)
+    {
+        auto &path = game.find_path(goal);
+        if (!path.empty())
+            return {path[0].first - at.first, path[0].second - at.second, player::act_move};
+    }
+
+    // Any straight move that isn't into a wall.
+    const region &reg = game.get_region();
+    int open[4], n = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        int x = at.first + moves[i][0], y = at.second + moves[i][1];
+        if (reg.in_bounds(x, y) && reg.walkable(x, y))
+            open[n++] = i;
+    }
+    auto &m = moves[n > 0 ? open[r.get_range(0, n - 1)] : r.get_range(0, 3)];
+    return {m[0], m[1], player::act_move};
+}
+
+static game_result play(size_t seed, size_t max_turns)
+{
+    game_result res = {0, 0, 0, false, false, 0.0};
+    auto start = std::chrono::steady_clock::now();
+
+    the_game game(nullptr, seed, 0);
+    res.empty = game.get_plants().size() == 0;
+    rng r(seed);
+    std::vector<turn_action> script(1);
+    while (res.turns < max_turns && game.get_plants().size() > 0)
+    {
+        script[0] = bot_turn(game, r);
+        auto sum = game.step(1, script);
+        if (sum.turns == 0)
+            break;
+        res.turns += sum.turns;
+        res.spawned += sum.by_plants[entity::did_spawn];
+        res.plants_killed += sum.by_plants[entity::did_die];
+    }
+    res.died = game.get_player().is_dead();
+
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return res;
+}
+
+int main(int argc, char **argv)
+{
+    size_t games = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    size_t seed = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1;
+    size_t max_turns = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1000;
+
+    // region::generate prints every map it makes.
+    std::cout.setstate(std::ios::badbit);
+
+    std::vector<game_result> results(games);
+    thread_pool pool;
+
+    auto start = std::chrono::steady_clock::now();
+    pool.run(games, [&](size_t i) { results[i] = play(seed + i, max_turns); });
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t turns = 0, spawned = 0, killed = 0, deaths = 0, empty = 0;
+    size_t min_turns = max_turns, max_seen = 0;
+    double turn_seconds = 0.0;
+    for (auto &res : results)
+    {
+        if (res.empty)
+        {
+            ++empty;
+            continue;
+        }
+        turns += res.turns;
+        spawned += res.spawned;
+        killed += res.plants_killed;
+        deaths += res.died ? 1 : 0;
+        min_turns = std::min(min_turns, res.turns);
+        max_seen = std::max(max_seen, res.turns);
+        turn_seconds += res.seconds;
+    }
+
+    double n = std::max<size_t>(games - empty, 1);
+    if (empty == games)
+        min_turns = 0;
+    std::fprintf(stderr, "%zu games on %zu threads in %.2fs (%.0f games/s)\n",
+        games, pool.get_workers() + 1, secs, games / secs);
+    std::fprintf(stderr, "%zu games started without plants, not counted below\n", empty);
+    std::fprintf(stderr, "turns: mean %.1f, min %zu, max %zu\n", turns / n, min_turns, max_seen);
+    std::fprintf(stderr, "player died in %zu games (%.1f%%)\n", deaths, 100.0 * deaths / n);
+    std::fprintf(stderr, "plants: %.1f spawned, %.1f killed per game\n", spawned / n, killed / n);
+    std::fprintf(stderr, "turn time: %.1f us mean\n", turns ? turn_seconds * 1e6 / turns : 0.0);
+    return 0;
+}
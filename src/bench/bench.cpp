@@ -0,0 +1,332 @@
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include <game_screen.hpp>
+#include <the_game.hpp>
+#include <utils/resource_manager.hpp>
+#include <utils/texture_atlas.hpp>
+
+// Times the hot parts of the game and writes the results as JSON, so runs
+// from two commits can be diffed.
+//
+//   bilebio_bench [out.json]
+//
+// Every case runs its body until at least min_seconds have gone by and
+// reports the average time of one run. The game prints a lot of debugging
+// to stdout, hence the file.
+
+static constexpr double min_seconds = 0.25;
+
+struct result
+{
+    std::string name;
+    std::string param;
+    long value;
+    long iterations;
+    double ns_per_op;
+};
+
+static std::vector<result> results;
+
+// body does ops operations per call, ns_per_op is per operation. setup,
+// if given, runs before every call and isn't timed.
+static void bench(const std::string &name, const std::string &param, long value, long ops,
+    const std::function<void()> &body, const std::function<void()> &setup=nullptr)
+{
+    using clock = std::chrono::steady_clock;
+
+    long iterations = 0;
+    double secs = 0.0;
+    do
+    {
+        if (setup)
+            setup();
+        auto start = clock::now();
+        body();
+        secs += std::chrono::duration<double>(clock::now() - start).count();
+        ++iterations;
+    } while (secs < min_seconds);
+
+    double ns = secs * 1e9 / (iterations * ops);
+    results.push_back({name, param, value, iterations, ns});
+    std::fprintf(stderr, "%-24s %s=%-6ld %12.1f ns/op\n", name.c_str(), param.c_str(), value, ns);
+}
+
+// Fills the first n empty tiles of a w x h map, walking it in a scrambled
+// order so the plants don't all end up in one corner.
+static std::vector<std::pair<int, int>> scattered_coords(size_t w, size_t h, size_t n, rng &r)
+{
+    std::vector<std::pair<int, int>> coords;
+    for (size_t y = 0; y < h; ++y)
+        for (size_t x = 0; x < w; ++x)
+            coords.push_back({(int)x, (int)y});
+    r.shuffle(coords.begin(), coords.end());
+    if (coords.size() > n)
+        coords.resize(n);
+    return coords;
+}
+
+static void bench_region()
+{
+    for (long size : {20, 40, 80, 160})
+    {
+        region reg;
+        unsigned seed = 1;
+        bench("region_generate", "size", size, 1, [&] { reg.generate(size, size, seed++); });
+    }
+}
+
+static void bench_map()
+{
+    const size_t w = 64, h = 64;
+    for (long n : {256, 1024, 4096})
+    {
+        rng r(1);
+        auto coords = scattered_coords(w, h, n, r);
+        sparse_2d_map map;
+        map.resize(w, h);
+
+        // Every op is an add and the del that undoes it, so the map ends up
+        // as empty as it started without a clear() in the timing.
+        std::vector<handle> added(coords.size());
+        bench("map_insert", "count", n, n, [&]
+        {
+            for (size_t i = 0; i < coords.size(); ++i)
+                added[i] = map.add(coords[i]);
+            for (auto h : added)
+                map.del(h);
+        });
+        for (auto &c : coords)
+            map.add(c);
+
+        size_t found = 0;
+        bench("map_lookup", "count", n, w * h, [&]
+        {
+            for (int y = 0; y < (int)h; ++y)
+                for (int x = 0; x < (int)w; ++x)
+                    found += map.get_handle({x, y}).is_null() ? 0 : 1;
+        });
+
+        std::vector<handle> handles;
+        for (auto &e : map)
+            handles.push_back(e.second);
+        bench("map_move", "count", n, handles.size(), [&]
+        {
+            for (auto h : handles)
+            {
+                auto c = map.get_coord(h);
+                auto to = std::make_pair(c.first + r.get_range(-1, 1), c.second + r.get_range(-1, 1));
+                if (map.in_bounds(to) && !map.exists(to))
+                    map.move_to(h, to);
+            }
+            map.get_changed().clear();
+        });
+
+        long sum = 0;
+        bench("map_iterate", "count", n, n, [&]
+        {
+            for (auto &e : map)
+                sum += e.first.first + e.first.second;
+        });
+
+        if (found == 0 && sum == 0)
+            std::fprintf(stderr, "nothing found\n");
+    }
+}
+
+static void bench_empty_neighbors()
+{
+    const size_t w = 64, h = 64;
+    for (long n : {256, 1024, 2048})
+    {
+        rng r(1);
+        region reg;
+        reg.generate(w, h, 1);
+        sparse_2d_map map;
+        map.resize(w, h);
+        plant_store plants(&reg, &r, &map, nullptr);
+        plants.reserve(w * h);
+
+        std::vector<handle> handles;
+        for (auto &c : scattered_coords(w, h, n, r))
+            handles.push_back(plants.add(pt_vine, c, handle()));
+
+        std::vector<std::pair<int, int>> neighbors;
+        size_t total = 0;
+        bench("plant_empty_neighbors", "plants", n, handles.size(), [&]
+        {
+            for (auto h : handles)
+                total += plants.empty_neighbors(h, neighbors).size();
+        });
+        if (total == 0)
+            std::fprintf(stderr, "no empty neighbors\n");
+    }
+}
+
+static void bench_paths()
+{
+    for (long size : {40, 160})
+    {
+        region reg;
+        reg.generate(size, size, 1);
+        sparse_2d_map map;
+        map.resize(size, size);
+        map.set_terrain(reg);
+
+        std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> queries;
+        for (int i = 0; i < 1000; ++i)
+            queries.push_back({reg.get_random_empty_coord(), reg.get_random_empty_coord()});
+
+        size_t steps = 0;
+        pathfinder paths(&map);
+        bench("pathfinder_find", "size", size, queries.size(), [&]
+        {
+            for (auto &q : queries)
+                steps += paths.find(q.first, q.second).size();
+        });
+        // What the player walks with.
+        pathfinder straight(&map, false);
+        bench("pathfinder_find_straight", "size", size, queries.size(), [&]
+        {
+            for (auto &q : queries)
+                steps += straight.find(q.first, q.second).size();
+        });
+        if (steps == 0)
+            std::fprintf(stderr, "no paths\n");
+    }
+}
+
+// A size x size game with up to n extra vines on random empty tiles.
+static std::unique_ptr<the_game> crowded_game(size_t size, size_t n)
+{
+    std::unique_ptr<the_game> game(new the_game(nullptr, 1));
+    game->set_level_size(size, size);
+    game->reset();
+    rng r(2);
+    auto &reg = game->get_region();
+    auto coords = scattered_coords(reg.get_width(), reg.get_height(), reg.get_width() * reg.get_height(), r);
+    for (auto &c : coords)
+    {
+        if (n == 0)
+            break;
+        if (reg.walkable(c.first, c.second) && !game->get_entity_at(c.first, c.second))
+        {
+            game->get_plants().add(pt_vine, c, handle());
+            --n;
+        }
+    }
+    return game;
+}
+
+// The smallest level, going up 10 tiles a side at a time, whose floor fits
+// n plants with as much room again for them to grow into.
+static size_t size_for(size_t n)
+{
+    for (size_t size = 20; ; size += 10)
+    {
+        auto game = crowded_game(size, 0);
+        auto &reg = game->get_region();
+        size_t floor = 0;
+        for (size_t y = 0; y < reg.get_height(); ++y)
+            for (size_t x = 0; x < reg.get_width(); ++x)
+                floor += reg.walkable(x, y);
+        if (floor >= 2 * n)
+            return size;
+    }
+}
+
+static void bench_rest_act()
+{
+    // Every run starts from the same crowded level, otherwise later runs
+    // would time whatever the plants had grown into by then.
+    const long turns = 10;
+    for (long n : {0, 25, 50, 100, 200})
+    {
+        auto size = size_for(n);
+        std::unique_ptr<the_game> game;
+        auto placed = crowded_game(size, n)->get_plants().size();
+        bench("the_game_rest_act", "plants", placed, turns, [&]
+        {
+            for (long i = 0; i < turns; ++i)
+                game->rest_act();
+        }, [&] { game = crowded_game(size, n); });
+    }
+}
+
+static void bench_render()
+{
+    sf::RenderTexture target;
+    if (!target.create(320, 320))
+    {
+        std::fprintf(stderr, "no offscreen target, skipping render\n");
+        return;
+    }
+
+    sf::Image image;
+    image.create(64, 64, sf::Color::White);
+    texture_atlas atlas;
+    for (auto key : {"floor", "rocks", "seed", "vine", "root", "player", "player_sw1", "player_sw2", "player_sa"})
+        atlas.add(key, image);
+    atlas.build();
+    resource_manager sprites;
+    sprites.manage<texture_atlas>("atlas", atlas);
+
+    for (long n : {0, 100, 200})
+    {
+        auto game = crowded_game(size_for(n), n);
+        player_controller controller(game.get(), &sprites);
+        the_game_renderer renderer(&sprites, game.get(), &controller);
+        target.setView(sf::View(sf::FloatRect(0, 0, 1, 1)));
+        bench("the_game_renderer_render", "plants", game->get_plants().size(), 1, [&]
+        {
+            target.clear();
+            renderer.render(&target);
+            target.display();
+        });
+    }
+}
+
+static void write_json(FILE *out)
+{
+    std::fprintf(out, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        auto &r = results[i];
+        std::fprintf(out, "    {\"name\": \"%s\", \"params\": {\"%s\": %ld}, \"iterations\": %ld, \"ns_per_op\": %.1f}%s\n",
+            r.name.c_str(), r.param.c_str(), r.value, r.iterations, r.ns_per_op,
+            i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "bench.json";
+
+    // region::generate prints every map it makes.
+    std::cout.setstate(std::ios::badbit);
+
+    bench_region();
+    bench_map();
+    bench_empty_neighbors();
+    bench_paths();
+    bench_rest_act();
+    bench_render();
+
+    FILE *out = std::fopen(path, "w");
+    if (!out)
+    {
+        std::fprintf(stderr, "can't write %s\n", path);
+        return 1;
+    }
+    write_json(out);
+    std::fclose(out);
+    return 0;
+}
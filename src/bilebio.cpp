@@ -9,6 +9,7 @@
 #include <main_menu_screen.hpp>
 #include <screen_manager.hpp>
 #include <utils/resource_manager.hpp>
+#include <utils/texture_atlas.hpp>
 
 // Yay for SFINAE
 template <typename T>
@@ -70,21 +71,49 @@ int main()
     load_resource<sf::Texture>(rm, "frame", "resources/frame.png");
     load_resource<sf::Texture>(rm, "death_screen", "resources/death_screen.png");
 
-    load_resource<sf::Texture>(rm, "heart", "resources/heart.png");
-    load_resource<sf::Texture>(rm, "energy", "resources/energy.png");
-    load_resource<sf::Texture>(rm, "noheart", "resources/noheart.png");
-    load_resource<sf::Texture>(rm, "noenergy", "resources/noenergy.png");
-
-    load_resource<sf::Texture>(rm, "player", "resources/player.png", sf::IntRect(0, 0, 64, 64));
-    load_resource<sf::Texture>(rm, "player_sw1", "resources/player.png", sf::IntRect(64, 0, 64, 64));
-    load_resource<sf::Texture>(rm, "player_sw2", "resources/player.png", sf::IntRect(64*2, 0, 64, 64));
-    load_resource<sf::Texture>(rm, "player_sa", "resources/player.png", sf::IntRect(64*3, 0, 64, 64));
-    load_resource<sf::Texture>(rm, "root", "resources/root.png");
-    load_resource<sf::Texture>(rm, "seed", "resources/seed.png", sf::IntRect(64*2, 0, 64, 64));
-    load_resource<sf::Texture>(rm, "vine", "resources/vine.png");
-
-    load_resource<sf::Texture>(rm, "floor", "resources/jungle_floor.png");
-    load_resource<sf::Texture>(rm, "rocks", "resources/rocks.png", sf::IntRect(0, 0, 64, 64));
+    // Every sprite drawn during a game goes in the atlas, sheets are
+    // cut up into frames. The game can't draw without any of them.
+    struct sprite
+    {
+        const char *key;
+        const char *filename;
+        sf::IntRect rect;
+    };
+    const sprite sprites[] = {
+        {"heart", "resources/heart.png", sf::IntRect()},
+        {"energy", "resources/energy.png", sf::IntRect()},
+        {"noheart", "resources/noheart.png", sf::IntRect()},
+        {"noenergy", "resources/noenergy.png", sf::IntRect()},
+
+        {"player", "resources/player.png", sf::IntRect(0, 0, 64, 64)},
+        {"player_sw1", "resources/player.png", sf::IntRect(64, 0, 64, 64)},
+        {"player_sw2", "resources/player.png", sf::IntRect(64*2, 0, 64, 64)},
+        {"player_sa", "resources/player.png", sf::IntRect(64*3, 0, 64, 64)},
+        {"root", "resources/root.png", sf::IntRect()},
+        {"seed", "resources/seed.png", sf::IntRect(64*2, 0, 64, 64)},
+        {"vine", "resources/vine.png", sf::IntRect()},
+        {"flower", "resources/flower.png", sf::IntRect()},
+        {"evil_vine", "resources/evil_vine.png", sf::IntRect()},
+
+        {"floor", "resources/jungle_floor.png", sf::IntRect()},
+        {"rocks", "resources/rocks.png", sf::IntRect(0, 0, 64, 64)},
+    };
+
+    texture_atlas atlas;
+    for (auto &s : sprites)
+    {
+        if (!atlas.add_file(s.key, s.filename, s.rect))
+        {
+            std::cerr << "couldn't load " << s.filename << std::endl;
+            return 1;
+        }
+    }
+    if (!atlas.build())
+    {
+        std::cerr << "couldn't build the texture atlas" << std::endl;
+        return 1;
+    }
+    rm.manage<texture_atlas>("atlas", atlas);
 
 
     screen_manager sm;
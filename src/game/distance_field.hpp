@@ -0,0 +1,99 @@
+
+#ifndef DISTANCE_FIELD_HPP
+#define DISTANCE_FIELD_HPP
+
+#include <boost/noncopyable.hpp>
+#include <cstdint>
+#include <vector>
+
+#include <entity.hpp>
+#include <region.hpp>
+
+// How many steps away each tile is from one spot, walking over floor in any
+// of the eight directions, for every tile within a circle around it. Walls
+// are walked around, not through, and diagonal steps don't cut their
+// corners, same as pathfinder. A tile only counts if it can be walked to
+// without leaving the circle. Filling it costs as much as the tiles it
+// reaches, so it can be redone every turn.
+class distance_field : private boost::noncopyable
+{
+private:
+    using int_pair = std::pair<int, int>;
+public:
+    static constexpr uint16_t unreached = 0xffff;
+
+    distance_field() : width_(0), height_(0), origin_(-1, -1) { }
+
+    // Works out every tile less than radius away from from, as the crow
+    // flies.
+    void fill(const region &reg, int_pair from, int radius)
+    {
+        clear();
+        if (reg.get_width() != width_ || reg.get_height() != height_)
+        {
+            width_ = reg.get_width();
+            height_ = reg.get_height();
+            dist_.assign(width_ * height_, static_cast<uint16_t>(unreached));
+        }
+        if (!reg.in_bounds(from.first, from.second))
+            return;
+
+        origin_ = from;
+        dist_[cell(from)] = 0;
+        reached_.push_back(from);
+        // reached_ doubles as the queue, it ends up sorted by distance.
+        for (size_t next = 0; next < reached_.size(); ++next)
+        {
+            auto c = reached_[next];
+            auto d = dist_[cell(c)];
+            for (int k = 0; k < 8; ++k)
+            {
+                int dx = neighbor_offsets[k][0], dy = neighbor_offsets[k][1];
+                int x = c.first + dx, y = c.second + dy;
+                int ox = x - from.first, oy = y - from.second;
+                if (ox * ox + oy * oy >= radius * radius)
+                    continue;
+                if (!open(reg, x, y) || dist_[cell({x, y})] != unreached)
+                    continue;
+                if (dx != 0 && dy != 0 && (!open(reg, c.first + dx, c.second) || !open(reg, c.first, c.second + dy)))
+                    continue;
+                dist_[cell({x, y})] = d + 1;
+                reached_.push_back({x, y});
+            }
+        }
+    }
+
+    // Only resets the tiles the last fill reached.
+    void clear()
+    {
+        for (auto c : reached_)
+            dist_[cell(c)] = unreached;
+        reached_.clear();
+        origin_ = {-1, -1};
+    }
+
+    uint16_t at(int_pair c) const
+    {
+        if (c.first < 0 || c.second < 0 || (size_t)c.first >= width_ || (size_t)c.second >= height_)
+            return unreached;
+        return dist_[cell(c)];
+    }
+
+    // -1, -1 when empty.
+    int_pair get_origin() const { return origin_; }
+    // Every tile reached, closest first.
+    const std::vector<int_pair> &get_reached() const { return reached_; }
+
+private:
+    size_t cell(int_pair c) const { return c.second * width_ + c.first; }
+
+    static bool open(const region &reg, int x, int y) { return reg.in_bounds(x, y) && reg.walkable(x, y); }
+
+    size_t width_;
+    size_t height_;
+    int_pair origin_;
+    std::vector<uint16_t> dist_;
+    std::vector<int_pair> reached_;
+};
+
+#endif
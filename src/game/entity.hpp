@@ -3,11 +3,14 @@
 #define ENTITY_HPP
 
 #include <algorithm>
-#include <map>
+#include <cstdint>
 #include <memory>
 #include <stdexcept>
 #include <utility>
+#include <vector>
 
+#include <cow_vector.hpp>
+#include <handle.hpp>
 #include <random.hpp>
 #include <region.hpp>
 
@@ -31,7 +34,9 @@ public:
         did_move,
         did_grow,
         did_attack,
-        did_miss
+        did_miss,
+
+        did_count
     };
 
     entity(region *reg, rng *r) :
@@ -44,6 +49,9 @@ public:
     virtual const vitals &get_vitals() const { return vitals_; }
     virtual vitals &get_vitals() { return vitals_; }
 
+    handle get_handle() const { return self_; }
+    void set_handle(handle h) { self_ = h; }
+
     virtual bool is_dead() const { return vitals_.hearts <= 0; }
     virtual bool is_alive() const { return !is_dead(); }
 
@@ -68,131 +76,336 @@ protected:
 
     region *region_;
     rng *rng_;
+
+    // Where this entity is in the level's sparse_2d_map.
+    handle self_;
 };
 
-template <typename T>
-class sparse_2d_map
+// The 8 tiles around one, in the same order as the directions in
+// directional.hpp. Bit d of an open mask stands for neighbor_offsets[d].
+constexpr int neighbor_offsets[8][2] = {
+    {0, 1}, {1, 1}, {1, 0}, {1, -1}, {0, -1}, {-1, -1}, {-1, 0}, {-1, 1}
+};
+
+// Hands out the handles for everything in a level and tracks where each one
+// stands. At most one thing per tile. What a handle actually is (the player,
+// a plant) lives with whoever asked for it, indexed by handle index.
+//
+// Freed slots are reused, and every handle handed out gets a generation no
+// other handle has had, so dropping a whole level is just forgetting the
+// slots. Since there is at most one thing per tile, nothing in here grows
+// past width x height.
+//
+// It also keeps, per tile, a mask of which neighbours are open (in bounds,
+// walkable and empty), patched up whenever a tile is taken or freed.
+//
+// Every tile is stamped with the clear() it was last written after. A tile
+// with an older stamp reads as empty, with only the terrain closing off its
+// neighbours, so clear() doesn't have to touch the tiles at all.
+//
+// The tables are cow_vectors, so a clone() shares them with the original
+// until either one writes.
+class sparse_2d_map : private boost::noncopyable
 {
 private:
-    using weak_ptr = std::weak_ptr<T>;
-    using shared_ptr = std::shared_ptr<T>;
-    using shared_const_ptr = std::shared_ptr<const T>;
     using int_pair = std::pair<int, int>;
-public:
-    sparse_2d_map() { }
+    using entry = std::pair<int_pair, handle>;
 
-    bool exists(int_pair coord) const { return coord_map_.find(coord) != coord_map_.end(); }
-    bool exists(shared_const_ptr ptr) const { return ptr_map_.find(ptr) != ptr_map_.end(); }
+    static constexpr size_t npos = static_cast<size_t>(-1);
+public:
+    sparse_2d_map() : next_generation_(0), width_(0), height_(0), epoch_(1) { }
 
-    // Should really only ever be used for a "this" argument.
-    weak_ptr get_this_ptr(const T *ent) const
+    // Clears the map and sizes the occupancy grid. Coordinates outside of
+    // width x height never exist.
+    void resize(size_t width, size_t height)
     {
-        for (auto &kv : coord_map_)
-            if (kv.second.get() == ent)
-                return kv.second;
-        return weak_ptr();
+        width_ = width;
+        height_ = height;
+        cells_.assign(width * height, static_cast<size_t>(npos));
+        walkable_.assign(width * height, 1);
+        open_.assign(width * height, 0);
+        bare_open_.assign(width * height, 0);
+        stamps_.assign(width * height, 0);
+        epoch_ = 1;
+        clear();
+        count_open();
     }
-    weak_ptr get_ptr(int_pair coord) const
+
+    std::unique_ptr<sparse_2d_map> clone() const
     {
-        if (!exists(coord))
-            return weak_ptr();
-        return coord_map_.at(coord);
+        std::unique_ptr<sparse_2d_map> c(new sparse_2d_map());
+        c->slots_ = slots_;
+        c->free_ = free_;
+        c->next_generation_ = next_generation_;
+        c->width_ = width_;
+        c->height_ = height_;
+        c->cells_ = cells_;
+        c->entries_ = entries_;
+        c->walkable_ = walkable_;
+        c->open_ = open_;
+        c->bare_open_ = bare_open_;
+        c->stamps_ = stamps_;
+        c->epoch_ = epoch_;
+        c->changed_ = changed_;
+        return c;
     }
-    int_pair get_coord(shared_const_ptr ptr) const
+
+    size_t get_width() const { return width_; }
+    size_t get_height() const { return height_; }
+    // One past the highest handle index handed out so far.
+    size_t get_capacity() const { return slots_.size(); }
+
+    bool in_bounds(int_pair coord) const
     {
-        if (!exists(ptr))
-            throw std::out_of_range("get_coord");
-        return ptr_map_.at(ptr);
+        return coord.first >= 0 && coord.first < (int)width_ &&
+            coord.second >= 0 && coord.second < (int)height_;
     }
 
-    void add_ptr(shared_ptr ptr, int_pair coord)
+    // Everything in bounds is walkable until this is called.
+    void set_terrain(const region &reg)
     {
-        coord_map_[coord] = ptr;
-        ptr_map_[ptr] = coord;
+        for (size_t y = 0; y < height_; ++y)
+            for (size_t x = 0; x < width_; ++x)
+                walkable_[y * width_ + x] = reg.walkable(x, y);
+        count_open();
     }
 
-    void add_ptr_later(shared_ptr ptr, int_pair coord)
+    bool walkable(int_pair coord) const { return in_bounds(coord) && walkable_[cell(coord)]; }
+    bool exists(int_pair coord) const { return in_bounds(coord) && occupant(cell(coord)) != npos; }
+    bool exists(handle h) const
     {
-        add_later_.push_back({ptr, coord});
+        return h.index < slots_.size() && slots_[h.index].entry != npos &&
+            slots_[h.index].generation == h.generation;
     }
-    void add_ptrs()
+
+    // Null handle if the tile is empty.
+    handle get_handle(int_pair coord) const
     {
-        for (auto &el : add_later_)
-            add_ptr(el.ptr, el.coord);
-        add_later_.clear();
+        if (!exists(coord))
+            return handle();
+        return entries_[occupant(cell(coord))].second;
     }
-
-    void del_ptr(shared_const_ptr ptr)
+    int_pair get_coord(handle h) const
     {
-        auto c = get_coord(ptr);
-        if (coord_map_[c] == ptr)
-            coord_map_.erase(c);
-        ptr_map_.erase(ptr);
+        if (!exists(h))
+            throw std::out_of_range("get_coord");
+        return entries_[slots_[h.index].entry].first;
     }
-    void del_ptr_later(shared_ptr ptr)
+
+    // Bit d is set if the tile at neighbor_offsets[d] from coord is open.
+    uint8_t get_open(int_pair coord) const
     {
-        del_later_.push_back(ptr);
+        auto i = cell(coord);
+        return stamps_[i] == epoch_ ? open_[i] : bare_open_[i];
     }
-    void del_ptrs()
+
+    // Things whose tile went from having no open neighbours to having some,
+    // or the other way, since whoever cares last cleared this.
+    std::vector<handle> &get_changed() { return changed_; }
+
+    // Null handle if the tile is already taken.
+    handle add(int_pair coord)
     {
-        for (auto &p : del_later_)
-            del_ptr(p);
-        del_later_.clear();
+        if (!in_bounds(coord))
+            throw std::out_of_range("add");
+        if (exists(coord))
+            return handle();
+
+        uint32_t index;
+        if (free_.empty())
+        {
+            index = slots_.size();
+            slots_.push_back(slot());
+        }
+        else
+        {
+            index = free_.back();
+            free_.pop_back();
+        }
+
+        auto &s = slots_[index];
+        s.generation = next_generation_++;
+        handle h(index, s.generation);
+        s.entry = entries_.size();
+        touch(cell(coord));
+        cells_[cell(coord)] = entries_.size();
+        entries_.push_back({coord, h});
+        update_open(coord);
+        return h;
     }
-    void del_coord_later(int_pair coord)
+
+    // Stale handles are ignored.
+    void del(handle h)
     {
-        del_ptr_later(get_ptr(coord).lock());
+        if (!exists(h))
+            return;
+
+        auto &s = slots_[h.index];
+        auto slot = s.entry;
+        auto coord = entries_[slot].first;
+        cells_[cell(coord)] = npos;
+
+        // Swaps the last entry into the hole, so iteration order isn't
+        // stable across deletes.
+        if (slot != entries_.size() - 1)
+        {
+            entries_[slot] = entries_.back();
+            cells_[cell(entries_[slot].first)] = slot;
+            slots_[entries_[slot].second.index].entry = slot;
+        }
+        entries_.pop_back();
+
+        s.entry = npos;
+        free_.push_back(h.index);
+        update_open(coord);
     }
 
-    void move_ptr_by(shared_ptr ptr, int_pair delta)
+    void move_by(handle h, int_pair delta)
     {
-        auto coord = get_coord(ptr);
+        auto coord = get_coord(h);
         auto to = int_pair(coord.first + delta.first, coord.second + delta.second);
-        move_ptr_to(ptr, to);
+        move_to(h, to);
     }
-    void move_ptr_to(shared_ptr ptr, int_pair coord)
+    void move_to(handle h, int_pair coord)
     {
-        del_ptr(ptr);
-        add_ptr(ptr, coord);
+        if (!in_bounds(coord) || !exists(h))
+            throw std::out_of_range("move_to");
+        if (exists(coord) && get_handle(coord) != h)
+            throw std::out_of_range("move_to");
+
+        auto slot = slots_[h.index].entry;
+        auto &e = entries_[slot];
+        auto from = e.first;
+        cells_[cell(from)] = npos;
+        e.first = coord;
+        touch(cell(coord));
+        cells_[cell(coord)] = slot;
+        update_open(from);
+        update_open(coord);
+        changed_.push_back(h);
     }
 
+    // Every outstanding handle goes stale. Doesn't touch the tiles, they
+    // just stop matching the stamp.
     void clear()
     {
-        coord_map_.clear();
-        ptr_map_.clear();
-        add_later_.clear();
+        // Once every 4 billion clears the old stamps could come back.
+        if (++epoch_ == 0)
+        {
+            stamps_.assign(stamps_.size(), 0);
+            epoch_ = 1;
+        }
+        slots_.clear();
+        free_.clear();
+        entries_.clear();
+        changed_.clear();
     }
 
-    typename std::map<int_pair, shared_ptr>::iterator begin()
+    typename cow_vector<entry>::const_iterator begin() const
     {
-        return coord_map_.begin();
+        return entries_.cbegin();
     }
 
-    typename std::map<int_pair, shared_ptr>::iterator end()
+    typename cow_vector<entry>::const_iterator end() const
     {
-        return coord_map_.end();
+        return entries_.cend();
     }
+private:
+    struct slot
+    {
+        slot() : generation(0), entry(npos) { }
+
+        uint32_t generation;
+        // Index into entries_, npos while the slot is free.
+        size_t entry;
+    };
+
+    size_t cell(int_pair coord) const { return coord.second * width_ + coord.first; }
+
+    // Index into entries_ of whatever stands on tile i, npos if nothing.
+    size_t occupant(size_t i) const { return stamps_[i] == epoch_ ? cells_[i] : npos; }
 
-    typename std::map<int_pair, shared_ptr>::const_iterator begin() const
+    // Brings tile i up to date with the last clear() before writing to it.
+    void touch(size_t i)
     {
-        return coord_map_.cbegin();
+        if (stamps_[i] == epoch_)
+            return;
+        stamps_[i] = epoch_;
+        cells_[i] = npos;
+        open_[i] = bare_open_[i];
     }
 
-    typename std::map<int_pair, shared_ptr>::const_iterator end() const
+    bool is_open(int_pair coord) const
     {
-        return coord_map_.cend();
+        return in_bounds(coord) && walkable_[cell(coord)] && occupant(cell(coord)) == npos;
     }
-private:
-    struct later
+
+    // Works out the masks of an empty map, and of every tile in use, from
+    // scratch. Only needed when the terrain changes.
+    void count_open()
     {
-        shared_ptr ptr;
-        int_pair coord;
-    };
+        for (int y = 0; y < (int)height_; ++y)
+        {
+            for (int x = 0; x < (int)width_; ++x)
+            {
+                uint8_t bare = 0, mask = 0;
+                for (int d = 0; d < 8; ++d)
+                {
+                    int_pair n = {x + neighbor_offsets[d][0], y + neighbor_offsets[d][1]};
+                    if (walkable(n))
+                        bare |= 1 << d;
+                    if (is_open(n))
+                        mask |= 1 << d;
+                }
+                auto i = y * width_ + x;
+                bare_open_[i] = bare;
+                if (stamps_[i] == epoch_)
+                    open_[i] = mask;
+            }
+        }
+    }
+
+    // The tile at coord was just taken or freed, so fix up the masks of
+    // the tiles around it.
+    void update_open(int_pair coord)
+    {
+        bool open = is_open(coord);
+        for (int d = 0; d < 8; ++d)
+        {
+            int_pair n = {coord.first + neighbor_offsets[d][0], coord.second + neighbor_offsets[d][1]};
+            if (!in_bounds(n))
+                continue;
+
+            // From n, coord is in the opposite direction.
+            uint8_t bit = 1 << ((d + 4) % 8);
+            touch(cell(n));
+            auto &mask = open_[cell(n)];
+            auto before = mask;
+            mask = open ? (mask | bit) : (mask & ~bit);
+            if ((before == 0) != (mask == 0) && cells_[cell(n)] != npos)
+                changed_.push_back(entries_[cells_[cell(n)]].second);
+        }
+    }
+
+    cow_vector<slot> slots_;
+    cow_vector<uint32_t> free_;
+    uint32_t next_generation_;
+
+    size_t width_;
+    size_t height_;
+    // Index into entries_ for every tile, npos if empty.
+    cow_vector<size_t> cells_;
+    // Densely packed (coord, handle) pairs, what iteration walks.
+    cow_vector<entry> entries_;
 
-    std::vector<later> add_later_;
-    std::vector<shared_ptr> del_later_;
-    std::map<int_pair, shared_ptr> coord_map_;
-    std::map<shared_const_ptr, int_pair> ptr_map_;
+    cow_vector<uint8_t> walkable_;
+    cow_vector<uint8_t> open_;
+    // What open_ is for a tile with nothing around it, just the terrain.
+    cow_vector<uint8_t> bare_open_;
+    // The epoch_ each tile's cells_ and open_ were last written in.
+    cow_vector<uint32_t> stamps_;
+    uint32_t epoch_;
+    std::vector<handle> changed_;
 };
 
 #endif
@@ -0,0 +1,35 @@
+
+#ifndef HANDLE_HPP
+#define HANDLE_HPP
+
+#include <cstdint>
+
+// Refers to an entity by its slot in the owning table plus the generation
+// the slot was at when the handle was made. Once the entity is removed the
+// slot's generation moves on, so old handles stop resolving instead of
+// dangling.
+struct handle
+{
+    static constexpr uint32_t null_index = static_cast<uint32_t>(-1);
+
+    handle() : index(null_index), generation(0) { }
+    handle(uint32_t i, uint32_t g) : index(i), generation(g) { }
+
+    bool is_null() const { return index == null_index; }
+    explicit operator bool() const { return !is_null(); }
+
+    uint32_t index;
+    uint32_t generation;
+};
+
+inline bool operator==(const handle &a, const handle &b)
+{
+    return a.index == b.index && a.generation == b.generation;
+}
+
+inline bool operator!=(const handle &a, const handle &b)
+{
+    return !(a == b);
+}
+
+#endif
@@ -0,0 +1,304 @@
+
+#ifndef PATHFINDER_HPP
+#define PATHFINDER_HPP
+
+#include <algorithm>
+#include <boost/noncopyable.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+#include <entity.hpp>
+
+// Shortest walks over a sparse_2d_map. With diagonals, in any of the eight
+// directions, diagonals costing a bit more than straight steps and never
+// cutting a wall's corner, searched with A* and jump point search so long
+// straight runs of open floor cost next to nothing. Without, only straight
+// up, down, left and right, with plain A*.
+//
+// Nothing is kept between searches but scratch space, since the map
+// changes every turn anyway. Not safe to share between threads.
+class pathfinder : private boost::noncopyable
+{
+private:
+    using int_pair = std::pair<int, int>;
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+    static constexpr int straight_cost = 10;
+    static constexpr int diagonal_cost = 14;
+public:
+    explicit pathfinder(const sparse_2d_map *map, bool diagonals=true) :
+        map_(map), diagonals_(diagonals), search_(0) { }
+
+    // The steps from from to to, not counting from. Walks around whatever
+    // stands in the way if it can, through it if it can't. Empty if to
+    // can't be reached or is from. Good until the next call.
+    const std::vector<int_pair> &find(int_pair from, int_pair to)
+    {
+        if (!search(from, to, true, path_))
+            search(from, to, false, path_);
+        return path_;
+    }
+
+private:
+    struct open_node
+    {
+        int f;
+        size_t cell;
+        bool operator>(const open_node &n) const { return f > n.f || (f == n.f && cell > n.cell); }
+    };
+
+    size_t cell(int_pair c) const { return c.second * map_->get_width() + c.first; }
+    int_pair coord(size_t i) const { return int_pair(i % map_->get_width(), i / map_->get_width()); }
+
+    static int sign(int v) { return (v > 0) - (v < 0); }
+
+    int cost(int_pair a, int_pair b) const
+    {
+        int dx = std::abs(a.first - b.first);
+        int dy = std::abs(a.second - b.second);
+        if (!diagonals_)
+            return straight_cost * (dx + dy);
+        return straight_cost * std::max(dx, dy) + (diagonal_cost - straight_cost) * std::min(dx, dy);
+    }
+
+    // The ends of the walk are always passable, the player stands on one
+    // and the other may be a plant to hit.
+    bool passable(int x, int y) const
+    {
+        int_pair c(x, y);
+        if (!map_->walkable(c))
+            return false;
+        return !avoid_ || c == from_ || c == to_ || !map_->exists(c);
+    }
+
+    bool search(int_pair from, int_pair to, bool avoid, std::vector<int_pair> &path)
+    {
+        path.clear();
+        if (from == to)
+            return true;
+        if (!map_->walkable(from) || !map_->walkable(to))
+            return false;
+
+        from_ = from;
+        to_ = to;
+        avoid_ = avoid;
+
+        size_t n = map_->get_width() * map_->get_height();
+        if (seen_.size() != n)
+        {
+            seen_.assign(n, 0);
+            closed_.assign(n, 0);
+            g_.resize(n);
+            parent_.resize(n);
+        }
+        // Stamps instead of clearing everything every search.
+        if (++search_ == 0)
+        {
+            seen_.assign(n, 0);
+            closed_.assign(n, 0);
+            search_ = 1;
+        }
+
+        std::greater<open_node> later;
+        open_.clear();
+        auto start = cell(from);
+        seen_[start] = search_;
+        g_[start] = 0;
+        parent_[start] = npos;
+        open_.push_back({cost(from, to), start});
+
+        while (!open_.empty())
+        {
+            std::pop_heap(open_.begin(), open_.end(), later);
+            auto at = open_.back().cell;
+            open_.pop_back();
+            if (closed_[at] == search_)
+                continue;
+            closed_[at] = search_;
+
+            if (at == cell(to))
+            {
+                build_path(at, path);
+                return true;
+            }
+
+            auto c = coord(at);
+            for (auto dir : pruned_directions(at))
+            {
+                int_pair jp;
+                if (!jump(c.first + dir.first, c.second + dir.second, dir.first, dir.second, jp))
+                    continue;
+                auto j = cell(jp);
+                if (closed_[j] == search_)
+                    continue;
+                int g = g_[at] + cost(c, jp);
+                if (seen_[j] != search_ || g < g_[j])
+                {
+                    seen_[j] = search_;
+                    g_[j] = g;
+                    parent_[j] = at;
+                    open_.push_back({g + cost(jp, to), j});
+                    std::push_heap(open_.begin(), open_.end(), later);
+                }
+            }
+        }
+        return false;
+    }
+
+    // The directions worth searching from a jump point, given the way it
+    // was reached. The start searches every way, and without diagonals
+    // every tile does.
+    const std::vector<int_pair> &pruned_directions(size_t at)
+    {
+        dirs_.clear();
+        auto c = coord(at);
+        int x = c.first, y = c.second;
+
+        if (!diagonals_)
+        {
+            for (int d = 0; d < 8; d += 2)
+                if (passable(x + neighbor_offsets[d][0], y + neighbor_offsets[d][1]))
+                    dirs_.push_back({neighbor_offsets[d][0], neighbor_offsets[d][1]});
+            return dirs_;
+        }
+
+        if (parent_[at] == npos)
+        {
+            for (int d = 0; d < 8; ++d)
+            {
+                int dx = neighbor_offsets[d][0], dy = neighbor_offsets[d][1];
+                if (passable(x + dx, y + dy) && (dx == 0 || dy == 0 || (passable(x + dx, y) && passable(x, y + dy))))
+                    dirs_.push_back({dx, dy});
+            }
+            return dirs_;
+        }
+
+        auto p = coord(parent_[at]);
+        int dx = sign(x - p.first), dy = sign(y - p.second);
+        if (dx != 0 && dy != 0)
+        {
+            bool along_y = passable(x, y + dy);
+            bool along_x = passable(x + dx, y);
+            if (along_y)
+                dirs_.push_back({0, dy});
+            if (along_x)
+                dirs_.push_back({dx, 0});
+            if (along_y && along_x && passable(x + dx, y + dy))
+                dirs_.push_back({dx, dy});
+        }
+        else if (dx != 0)
+        {
+            bool up = passable(x, y - 1);
+            bool down = passable(x, y + 1);
+            if (passable(x + dx, y))
+            {
+                dirs_.push_back({dx, 0});
+                if (down && passable(x + dx, y + 1))
+                    dirs_.push_back({dx, 1});
+                if (up && passable(x + dx, y - 1))
+                    dirs_.push_back({dx, -1});
+            }
+            if (down)
+                dirs_.push_back({0, 1});
+            if (up)
+                dirs_.push_back({0, -1});
+        }
+        else
+        {
+            bool left = passable(x - 1, y);
+            bool right = passable(x + 1, y);
+            if (passable(x, y + dy))
+            {
+                dirs_.push_back({0, dy});
+                if (right && passable(x + 1, y + dy))
+                    dirs_.push_back({1, dy});
+                if (left && passable(x - 1, y + dy))
+                    dirs_.push_back({-1, dy});
+            }
+            if (right)
+                dirs_.push_back({1, 0});
+            if (left)
+                dirs_.push_back({-1, 0});
+        }
+        return dirs_;
+    }
+
+    // Walks from x, y in direction dx, dy until something makes the tile
+    // worth stopping at: the goal, or a neighbour that only opens up from
+    // here. Diagonal walks stop where a straight walk off them would.
+    // Without diagonals every tile is worth stopping at.
+    bool jump(int x, int y, int dx, int dy, int_pair &found) const
+    {
+        int_pair unused;
+        for (;;)
+        {
+            if (!passable(x, y))
+                return false;
+            if (int_pair(x, y) == to_ || !diagonals_)
+                break;
+
+            if (dx != 0 && dy != 0)
+            {
+                if (jump(x + dx, y, dx, 0, unused) || jump(x, y + dy, 0, dy, unused))
+                    break;
+            }
+            else if (dx != 0)
+            {
+                if ((passable(x, y - 1) && !passable(x - dx, y - 1)) ||
+                    (passable(x, y + 1) && !passable(x - dx, y + 1)))
+                    break;
+            }
+            else
+            {
+                if ((passable(x - 1, y) && !passable(x - 1, y - dy)) ||
+                    (passable(x + 1, y) && !passable(x + 1, y - dy)))
+                    break;
+            }
+
+            // No cutting corners.
+            if (!passable(x + dx, y) || !passable(x, y + dy))
+                return false;
+            x += dx;
+            y += dy;
+        }
+        found = int_pair(x, y);
+        return true;
+    }
+
+    // Fills in the steps between the jump points, which always lie on a
+    // straight or diagonal line from each other.
+    void build_path(size_t at, std::vector<int_pair> &path) const
+    {
+        for (; parent_[at] != npos; at = parent_[at])
+        {
+            auto c = coord(at);
+            auto p = coord(parent_[at]);
+            int dx = sign(p.first - c.first), dy = sign(p.second - c.second);
+            for (; c != p; c.first += dx, c.second += dy)
+                path.push_back(c);
+        }
+        std::reverse(path.begin(), path.end());
+    }
+
+    const sparse_2d_map *map_;
+    bool diagonals_;
+    std::vector<int_pair> path_;
+
+    // The search under way.
+    int_pair from_;
+    int_pair to_;
+    bool avoid_;
+
+    // Per tile, reused between searches.
+    uint32_t search_;
+    std::vector<uint32_t> seen_;
+    std::vector<uint32_t> closed_;
+    std::vector<int> g_;
+    std::vector<size_t> parent_;
+    std::vector<int_pair> dirs_;
+    std::vector<open_node> open_;
+};
+
+#endif
@@ -2,16 +2,21 @@
 #ifndef PLANTS_HPP
 #define PLANTS_HPP
 
+#include <algorithm>
 #include <boost/noncopyable.hpp>
-#include <boost/optional.hpp>
+#include <cstdint>
 #include <functional>
-#include <map>
 #include <memory>
-#include <tuple>
 #include <vector>
 
+#include <cow_vector.hpp>
+#include <distance_field.hpp>
 #include <entity.hpp>
+#include <handle.hpp>
 #include <random.hpp>
+#include <region.hpp>
+#include <thread_pool.hpp>
+#include <timing_wheel.hpp>
 
 // Current plant types:
 // "seed"
@@ -20,329 +25,893 @@
 // "flower"
 // "fruit"
 
+enum plant_type : uint8_t
+{
+    pt_none,
+    pt_seed,
+    pt_vine,
+    pt_root,
+
+    pt_count
+};
+
+// What every plant of a type starts out as.
+struct plant_archetype
+{
+    // Also the key of its sprite.
+    const char *name;
+    vitals base;
+    // Seeds: turns until grown. Roots: turns between spawns.
+    int timer;
+    // Roots: spawns per cooldown.
+    int growth_count;
+    // What a seed turns into once its timer runs out.
+    plant_type grows_into;
+};
+
+constexpr plant_archetype plant_archetypes[pt_count] = {
+    {"", {0, 0, 0, 0.0}, 0, 0, pt_none},
+    {"seed", {1, 1, 0, 0.0}, 3, 0, pt_vine},
+    {"vine", {3, 3, 1, 0.5}, 0, 0, pt_none},
+    {"root", {3, 3, 1, 0.5}, 3, 1, pt_none},
+    // {"flower", {3, 3, 0, 0.0}, 0, 0, pt_none},
+    // {"fruit", {1, 1, 0, 0.0}, 0, 0, pt_none},
+};
+
 struct biomass
 {
 };
 
-class plant : public entity, public std::enable_shared_from_this<plant>, private boost::noncopyable
+/*
+1a. If growing
+  1. Increment growth period for all plants growing
+  2. If done growing
+    1. Add plants on growth list to plant list
+    2. Set to not growing
+1b. If not growing
+  1. Find N plants on the outer edges of the whole plant group.
+  2a. Check if upgrade, or grow
+    1. Replace and set new plant to grow
+  2b. If grow instead
+    1. Find target to grow, if none, pick random area unnoccupied.
+  3. Add to growing list.
+2. Update all plants to do something to target. (attack)
+*/
+
+// Every plant in a level, stored column-wise. Each column is indexed by the
+// plant's handle index in the level's sparse_2d_map, and a row only counts
+// while its owner is still that handle. Plants are also listed by type, so
+// every act/spawn system only walks the rows it cares about.
+//
+// The columns are sized once per level and rows are recycled along with
+// the map's slots, so growing and dying don't allocate and clear() is
+// constant time. They're cow_vectors, so a clone() only copies the pages
+// either side writes to afterwards.
+//
+// Plants only act on turns they have something to do: when a timer runs
+// out (they're woken by a timing_wheel), when they've been hurt, or when
+// they're vines right next to the target.
+//
+// Every plant also keeps its frontier: the vines it spawned that still have
+// an open tile next to them. It's patched whenever the map reports a tile's
+// open neighbours changing, so growth never has to go looking for edges.
+//
+// act() and spawn() split the level into square chunks and run the chunks
+// on the thread pool. Each chunk only writes to its own plants' wake_ and
+// growth_count_ rows, and reads everything else through const members. It
+// queues up the rest (events, deaths, growth, new seeds), which is merged
+// back in chunk order afterwards. Every plant rolls from its own
+// stream, keyed by the game's seed, the turn and the plant's handle, so a
+// turn plays out the same no matter how many threads ran it.
+class plant_store : private boost::noncopyable
 {
-protected:
-    using weak_ptr = std::weak_ptr<entity>;
-    using shared_ptr = std::shared_ptr<entity>;
-    using shared_const_ptr = std::shared_ptr<const entity>;
+private:
     using int_pair = std::pair<int, int>;
-    using target_func = std::function<int_pair()>;
-    using on_did_func = std::function<void(weak_ptr src, entity::did did, weak_ptr targ)>;
+    using on_did_func = std::function<void(handle src, entity::did did, handle targ)>;
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+    // Plants closer than this to the target, as the crow flies, grow
+    // towards it. Only if there's a way to it that doesn't leave that
+    // circle, though.
+    static constexpr int target_reach = 6;
+    // Width and height of a chunk, in tiles.
+    static constexpr int chunk_size = 8;
 public:
-    using type = std::string;
-
-    plant(region *reg, rng *r, plant::type type, sparse_2d_map<entity> *pm, weak_ptr target, std::weak_ptr<plant> parent) :
-        entity(reg, r), type_(type), entities_(pm), target_(target), parent_(parent)
+    plant_store(region *reg, rng *r, sparse_2d_map *pm, thread_pool *pool) :
+        region_(reg), rng_(r), entities_(pm), pool_(pool), target_(nullptr), turn_(0), sim_radius_(0), chunks_wide_(0)
     {
-        grow_ = type;
     }
-    virtual ~plant()
+
+    // A copy of every plant for a copy of the level. The target isn't
+    // carried over.
+    std::unique_ptr<plant_store> clone(region *reg, rng *r, sparse_2d_map *pm, thread_pool *pool) const
     {
-        std::printf("%s destroyed\n", type_.c_str());
+        std::unique_ptr<plant_store> c(new plant_store(reg, r, pm, pool));
+        c->turn_ = turn_;
+        c->sim_radius_ = sim_radius_;
+        c->owner_ = owner_;
+        c->type_ = type_;
+        c->vitals_ = vitals_;
+        c->wake_ = wake_;
+        c->acted_ = acted_;
+        c->asleep_ = asleep_;
+        c->growth_count_ = growth_count_;
+        c->parent_ = parent_;
+        c->list_slot_ = list_slot_;
+        c->frontier_slot_ = frontier_slot_;
+        c->frontier_ = frontier_;
+        for (int type = 0; type < pt_count; ++type)
+            c->by_type_[type] = by_type_[type];
+        c->add_later_ = add_later_;
+        c->del_later_ = del_later_;
+        c->grow_later_ = grow_later_;
+        c->wakes_ = wakes_;
+        c->hurt_ = hurt_;
+        return c;
     }
 
-    virtual plant::type get_type() const { return type_; }
-    virtual weak_ptr get_target() const { return target_; }
-    virtual const weak_ptr get_parent() const { return parent_; }
-    virtual bool can_spawn_more() const { return false; }
-    virtual void spawned_something() { }
+    // What every plant tries to reach and attack.
+    void set_target(entity *targ) { target_ = targ; }
 
-    virtual void act(on_did_func on_did)
+    // Roots farther than radius tiles from the target stop spawning, and
+    // when it gets close again make up for the turns they missed in one go.
+    // 0 keeps every root spawning every turn.
+    void set_sim_radius(int radius) { sim_radius_ = radius; }
+
+    bool is_plant(handle h) const
     {
-        if (is_dead())
+        return h.index < owner_.size() && owner_[h.index] == h && entities_->exists(h);
+    }
+    plant_type get_type(handle h) const { return is_plant(h) ? type_[h.index] : pt_none; }
+    const vitals &get_vitals(handle h) const { return vitals_[h.index]; }
+    handle get_parent(handle h) const { return parent_[h.index]; }
+    const cow_vector<handle> &get_all(plant_type type) const { return by_type_[type]; }
+    const std::vector<handle> &get_frontier(handle h) const { return frontier_[h.index]; }
+
+    // The open tiles around pl. Fills and returns neighbors.
+    const std::vector<int_pair> &empty_neighbors(handle pl, std::vector<int_pair> &neighbors) const
+    {
+        neighbors.clear();
+        if (entities_->exists(pl))
         {
-            on_did(shared_from_this(), entity::did_die, weak_ptr());
-            entities_->del_ptr_later(shared_from_this());
-            return;
+            auto around = entities_->get_coord(pl);
+            auto open = entities_->get_open(around);
+            for (int d = 0; d < 8; ++d)
+                if (open & (1 << d))
+                    neighbors.push_back({around.first + neighbor_offsets[d][0], around.second + neighbor_offsets[d][1]});
         }
+        return neighbors;
     }
-    virtual void spawn(on_did_func on_did) = 0;
 
-protected:
-    plant::type type_;
-    plant::type grow_;
-    sparse_2d_map<entity> *entities_;
-    weak_ptr target_;
-    // Can't be shared. Would impose a circular reference.
-    std::weak_ptr<plant> parent_;
+    // Makes room for n rows up front, so a level never has to grow the
+    // columns mid-turn.
+    void reserve(size_t n)
+    {
+        if (n > owner_.size())
+            grow_columns(n);
+        for (auto &list : by_type_)
+            list.reserve(n);
+        add_later_.reserve(n);
+        del_later_.reserve(n);
+        grow_later_.reserve(n);
+    }
 
-    // Helper functions.
+    size_t size() const
+    {
+        size_t n = 0;
+        for (auto &list : by_type_)
+            n += list.size();
+        return n;
+    }
 
-    std::vector<int_pair> empty_neighbors(weak_ptr pl, int range=1)
+    void take_damage(handle h, int dam)
     {
-        std::vector<int_pair> neighbors;
-        if (auto sptr = pl.lock())
+        if (!is_plant(h))
+            return;
+        vitals_[h.index].hearts = std::max(vitals_[h.index].hearts - dam, 0);
+        hurt_.push_back(h);
+    }
+
+    // Places a plant right away, null handle if the tile is taken.
+    handle add(plant_type type, int_pair coord, handle parent)
+    {
+        auto h = entities_->add(coord);
+        if (!h)
+            return h;
+
+        if (h.index >= owner_.size())
+            reserve(h.index + 1);
+
+        owner_[h.index] = h;
+        parent_[h.index] = parent;
+        frontier_slot_[h.index] = npos;
+        frontier_[h.index].clear();
+        init_row(h, type);
+        list_add(h);
+        frontier_update(h);
+        return h;
+    }
+
+    // Deferred versions, for use while the columns are being walked.
+    void add_later(plant_type type, int_pair coord, handle parent)
+    {
+        add_later_.push_back({type, coord, parent});
+    }
+    void del_later(handle h)
+    {
+        del_later_.push_back(h);
+    }
+    // Turns a plant into another type in place, it keeps its handle, tile
+    // and parent.
+    void grow_later(handle h, plant_type into)
+    {
+        grow_later_.push_back({h, into});
+    }
+
+    // Two plants growing onto the same tile in one pass, the first wins.
+    void add_plants(const on_did_func &on_did)
+    {
+        for (auto &g : grow_later_)
         {
-            auto around = entities_->get_coord(sptr);
-            for (int dx = -range; dx <= range; ++dx)
-            {
-                for (int dy = -range; dy <= range; ++dy)
-                {
-                    int_pair v = {around.first + dx, around.second + dy};
-                    if (!entities_->exists(v) && region_->walkable(v.first, v.second))
-                        neighbors.push_back(v);
-                }
-            }
+            if (!is_plant(g.h))
+                continue;
+            list_del(g.h);
+            init_row(g.h, g.into);
+            list_add(g.h);
+            frontier_update(g.h);
+            if (on_did != nullptr)
+                on_did(g.h, entity::did_grow, handle());
         }
-        return neighbors;
+        grow_later_.clear();
+
+        for (auto &el : add_later_)
+        {
+            auto h = add(el.type, el.coord, el.parent);
+            if (h && on_did != nullptr)
+                on_did(h, entity::did_spawn, el.parent);
+        }
+        add_later_.clear();
+    }
+    void del_plants()
+    {
+        for (auto &h : del_later_)
+            del(h);
+        del_later_.clear();
     }
 
-    template <typename P, typename... Args>
-    void grow_something(int_pair coord, Args... args)
+    void del(handle h)
     {
-        if (entities_->exists(coord))
-            entities_->del_coord_later(coord);
+        if (!is_plant(h))
+            return;
+
+        list_del(h);
+        frontier_del(h);
+        type_[h.index] = pt_none;
+        owner_[h.index] = handle();
+        entities_->del(h);
+    }
 
-        auto np = std::make_shared<P>(region_, rng_, entities_, target_, args...);
-        entities_->add_ptr_later(np, coord);
+    // Has to go along with clearing the map, the old rows are left as they
+    // are and just stop matching any handle.
+    void clear()
+    {
+        for (auto &list : by_type_)
+            list.clear();
+        add_later_.clear();
+        del_later_.clear();
+        grow_later_.clear();
+        hurt_.clear();
+        turn_ = 0;
+        wakes_.clear(turn_);
     }
 
-    boost::optional<int> manhattan_distance_between(weak_ptr a, weak_ptr b)
+    void act(const on_did_func &on_did)
     {
-        auto asptr = a.lock();
-        auto bsptr = b.lock();
+        ++turn_;
+        find_reach();
+        find_active();
+        split_into_chunks(active_);
+        run_chunks([this](chunk &c)
+        {
+            for (auto h : c.plants)
+            {
+                if (act_dead(h, c))
+                    continue;
+                switch (get_type(h))
+                {
+                case pt_seed: act_seed(h, c); break;
+                case pt_vine: act_vine(h, c); break;
+                case pt_root: act_root(h); break;
+                default: break;
+                }
+            }
+        });
 
-        if (asptr && bsptr && entities_->exists(asptr) && entities_->exists(bsptr))
+        for (auto &c : chunks_)
         {
-            auto acoord = entities_->get_coord(asptr);
-            auto bcoord = entities_->get_coord(bsptr);
-            auto dx = std::abs(acoord.first - bcoord.first);
-            auto dy = std::abs(acoord.second - bcoord.second);
-            return boost::optional<int>(dx + dy);
+            for (auto &e : c->events)
+                if (on_did != nullptr)
+                    on_did(e.src, e.did, e.targ);
+            for (auto &a : c->attackers)
+                attack_target(a, on_did);
+            del_later_.insert(del_later_.end(), c->dels.begin(), c->dels.end());
+            grow_later_.insert(grow_later_.end(), c->grows.begin(), c->grows.end());
         }
-
-        return boost::optional<int>();
     }
 
-    boost::optional<double> distance_between(weak_ptr a, weak_ptr b)
+    // Only roots can keep spawning, seeds and vines grow through them.
+    void spawn(const on_did_func &on_did)
     {
-        auto asptr = a.lock();
-        auto bsptr = b.lock();
+        update_frontier();
+        find_near_target();
 
-        if (asptr && bsptr && entities_->exists(asptr) && entities_->exists(bsptr))
+        if (sim_radius_ > 0)
         {
-            auto acoord = entities_->get_coord(asptr);
-            auto bcoord = entities_->get_coord(bsptr);
-            auto dx = acoord.first - bcoord.first;
-            auto dy = acoord.second - bcoord.second;
-            return boost::optional<double>(std::sqrt(dx * dx + dy * dy));
+            wake_near_roots(on_did);
+            split_into_chunks(awake_);
         }
+        else
+        {
+            split_into_chunks(by_type_[pt_root]);
+        }
+        run_chunks([this](chunk &c)
+        {
+            for (auto h : c.plants)
+                if (spawn_root(h, c, turn_))
+                    spawned_something(h, c, turn_);
+        });
 
-        return boost::optional<double>();
+        // Two roots spawning onto the same tile, the earlier chunk wins.
+        for (auto &c : chunks_)
+        {
+            add_later_.insert(add_later_.end(), c->adds.begin(), c->adds.end());
+            for (auto h : c->wakes)
+                wakes_.schedule(h, wake_[h.index]);
+        }
     }
-};
 
-class seed;
-class vine;
-
-class seed : public plant, private boost::noncopyable
-{
 private:
-    using weak_ptr = std::weak_ptr<entity>;
-    using shared_ptr = std::shared_ptr<entity>;
-    using on_did_func = std::function<void(weak_ptr src, entity::did did, weak_ptr targ)>;
-public:
+    struct later
+    {
+        plant_type type;
+        int_pair coord;
+        handle parent;
+    };
 
-    seed(region *reg, rng *r, sparse_2d_map<entity> *pm, weak_ptr target, std::weak_ptr<plant> parent, plant::type into) :
-        plant(reg, r, "seed", pm, target, parent), into_(into)
+    struct growth
     {
-        vitals_ = {1, 1, 0, 0.0};
-        timer_ = 3;
+        handle h;
+        plant_type into;
+    };
+
+    struct attack
+    {
+        handle h;
+        bool hit;
+    };
+
+    struct event
+    {
+        handle src;
+        entity::did did;
+        handle targ;
+    };
+
+    // One square of the level and whatever its plants did this pass.
+    struct chunk
+    {
+        std::vector<handle> plants;
+
+        std::vector<event> events;
+        std::vector<attack> attackers;
+        std::vector<handle> dels;
+        std::vector<growth> grows;
+        std::vector<later> adds;
+        // Roots whose wake-up turn was just set.
+        std::vector<handle> wakes;
+
+        // Reused by empty_neighbors.
+        std::vector<int_pair> neighbors;
+    };
+
+    region *region_;
+    rng *rng_;
+    sparse_2d_map *entities_;
+    thread_pool *pool_;
+    entity *target_;
+    // Counts act passes since the level started, part of every roll's key.
+    uint32_t turn_;
+    int sim_radius_;
+
+    // Columns.
+    cow_vector<handle> owner_;
+    cow_vector<plant_type> type_;
+    cow_vector<vitals> vitals_;
+    // Seeds: the turn they grow. Roots: the turn they can spawn again.
+    cow_vector<uint32_t> wake_;
+    // The last turn the plant acted on, so it doesn't act twice.
+    cow_vector<uint32_t> acted_;
+    // Roots: the turn they went out of range, 0 while they're in it.
+    cow_vector<uint32_t> asleep_;
+    // Roots: spawns left before the cooldown starts.
+    cow_vector<int> growth_count_;
+    // Whoever spawned the plant, may be stale.
+    cow_vector<handle> parent_;
+    // Position in by_type_[type].
+    cow_vector<size_t> list_slot_;
+    // Position in frontier_[parent], npos if not on it.
+    cow_vector<size_t> frontier_slot_;
+    cow_vector<std::vector<handle>> frontier_;
+
+    cow_vector<handle> by_type_[pt_count];
+
+    std::vector<later> add_later_;
+    std::vector<handle> del_later_;
+    std::vector<growth> grow_later_;
+
+    timing_wheel wakes_;
+    // Plants that took damage since the last act pass.
+    std::vector<handle> hurt_;
+    // Reused by find_active.
+    std::vector<handle> due_;
+    std::vector<handle> active_;
+
+    std::vector<std::unique_ptr<chunk>> chunks_;
+    size_t chunks_wide_;
+
+    // Steps to the target from everywhere within reach of it, worked out at
+    // the start of every act pass.
+    distance_field reach_;
+    // Vines within reach of the target, worked out once per spawn pass.
+    std::vector<handle> near_;
+    // Roots in range of the target this spawn pass.
+    std::vector<handle> awake_;
+    // Scratch space for catching up roots, outside of the chunk passes.
+    chunk catch_up_;
+
+    void grow_columns(size_t n)
+    {
+        owner_.resize(n);
+        type_.resize(n, pt_none);
+        vitals_.resize(n);
+        wake_.resize(n);
+        acted_.resize(n);
+        asleep_.resize(n);
+        growth_count_.resize(n);
+        parent_.resize(n);
+        list_slot_.resize(n);
+        frontier_slot_.resize(n, static_cast<size_t>(npos));
+        frontier_.resize(n);
+    }
+
+    void list_add(handle h)
+    {
+        auto &list = by_type_[type_[h.index]];
+        list_slot_[h.index] = list.size();
+        list.push_back(h);
+    }
+
+    // Swaps the last plant of the type into the hole.
+    void list_del(handle h)
+    {
+        auto &list = by_type_[type_[h.index]];
+        auto slot = list_slot_[h.index];
+        list[slot] = list.back();
+        list_slot_[list[slot].index] = slot;
+        list.pop_back();
     }
-    virtual ~seed()
+
+    void init_row(handle h, plant_type type)
     {
+        auto i = h.index;
+        const plant_archetype &arch = plant_archetypes[type];
+        type_[i] = type;
+        vitals_[i] = arch.base;
+        wake_[i] = turn_ + arch.timer;
+        acted_[i] = 0;
+        asleep_[i] = 0;
+        growth_count_[i] = arch.growth_count;
+        if (arch.timer > 0)
+            wakes_.schedule(h, wake_[i]);
     }
 
-    virtual void act(on_did_func on_did)
+    // On its parent's frontier if it's a vine with room to grow. A dead
+    // parent's row may already belong to someone else, whose frontier it
+    // mustn't end up on.
+    void frontier_update(handle h)
     {
-        if (is_dead())
+        auto i = h.index;
+        bool should = type_[i] == pt_vine && is_plant(parent_[i]) &&
+            entities_->get_open(entities_->get_coord(h)) != 0;
+        bool is = frontier_slot_[i] != npos;
+
+        if (should && !is)
         {
-            on_did(shared_from_this(), entity::did_die, weak_ptr());
-            entities_->del_ptr_later(shared_from_this());
-            return;
+            auto &list = frontier_[parent_[i].index];
+            frontier_slot_[i] = list.size();
+            list.push_back(h);
         }
-
-        if (--timer_ <= 0)
+        else if (!should && is)
         {
-            if (into_ == "vine")
-                grow_something<vine>(entities_->get_coord(shared_from_this()), parent_);
+            frontier_del(h);
         }
     }
 
-    virtual void spawn(on_did_func on_did)
+    void frontier_del(handle h)
     {
-        // Seeds don't spawn
-        (void)on_did;
+        auto i = h.index;
+        auto slot = frontier_slot_[i];
+        frontier_slot_[i] = npos;
+        if (slot == npos)
+            return;
+
+        // The parent's row may have been reused since, along with its list.
+        auto &list = frontier_[parent_[i].index];
+        if (slot >= list.size() || list[slot] != h)
+            return;
+
+        if (slot != list.size() - 1)
+        {
+            list[slot] = list.back();
+            frontier_slot_[list[slot].index] = slot;
+        }
+        list.pop_back();
     }
 
-protected:
-    plant::type into_;
-    int timer_;
-};
+    void update_frontier()
+    {
+        auto &changed = entities_->get_changed();
+        for (auto h : changed)
+            if (is_plant(h))
+                frontier_update(h);
+        changed.clear();
+    }
 
-class vine : public plant, private boost::noncopyable
-{
-private:
-    using weak_ptr = std::weak_ptr<entity>;
-    using shared_ptr = std::shared_ptr<entity>;
-    using on_did_func = std::function<void(weak_ptr src, entity::did did, weak_ptr targ)>;
-public:
+    void find_reach()
+    {
+        auto targ = target_handle();
+        if (entities_->exists(targ))
+            reach_.fill(*region_, entities_->get_coord(targ), target_reach);
+        else
+            reach_.clear();
+    }
 
-    vine(region *reg, rng *r, sparse_2d_map<entity> *pm, weak_ptr target, std::weak_ptr<plant> parent) :
-        plant(reg, r, "vine", pm, target, parent)
+    // Closest first.
+    void find_near_target()
     {
-        vitals_ = {3, 3, 1, 0.5};
-        // vitals_ = {1, 1, 0, 0.0}; // Seed
-        // vitals_ = {3, 3, 0, 0.0}; // Flower
-        // vitals_ = {1, 1, 0, 0.0}; // Fruit
+        near_.clear();
+        for (auto c : reach_.get_reached())
+        {
+            auto h = entities_->get_handle(c);
+            if (get_type(h) == pt_vine)
+                near_.push_back(h);
+        }
     }
-    virtual ~vine()
+
+    // Everything with something to do this turn: woken up, hurt, or a vine
+    // next to the target.
+    void find_active()
     {
+        active_.clear();
+
+        due_.clear();
+        wakes_.advance(turn_, due_);
+        for (auto h : due_)
+            if (is_plant(h) && wake_[h.index] == turn_)
+                mark_active(h);
+
+        for (auto h : hurt_)
+            if (is_plant(h))
+                mark_active(h);
+        hurt_.clear();
+
+        auto targ = target_handle();
+        if (entities_->exists(targ))
+        {
+            auto c = entities_->get_coord(targ);
+            // Only straight up, down, left and right are close enough.
+            for (int d = 0; d < 8; d += 2)
+            {
+                auto h = entities_->get_handle({c.first + neighbor_offsets[d][0], c.second + neighbor_offsets[d][1]});
+                if (get_type(h) == pt_vine)
+                    mark_active(h);
+            }
+        }
     }
 
-    virtual void act(on_did_func on_did)
+    // Sorts roots into in range, which go in awake_, and out of it. Roots
+    // coming back into range catch up first.
+    void wake_near_roots(const on_did_func &on_did)
     {
-        if (is_dead())
+        awake_.clear();
+
+        auto targ = target_handle();
+        if (!entities_->exists(targ))
         {
-            on_did(shared_from_this(), entity::did_die, weak_ptr());
-            entities_->del_ptr_later(shared_from_this());
+            awake_.insert(awake_.end(), by_type_[pt_root].begin(), by_type_[pt_root].end());
             return;
         }
 
-        auto targ_sptr = target_.lock();
-        if (targ_sptr && entities_->exists(targ_sptr))
+        auto tc = entities_->get_coord(targ);
+        bool caught_up = false;
+        for (auto h : by_type_[pt_root])
         {
-            auto distance = distance_between(shared_from_this(), targ_sptr);
-            if (distance && *distance <= 1.0)
+            auto c = entities_->get_coord(h);
+            auto dx = c.first - tc.first;
+            auto dy = c.second - tc.second;
+            if (dx * dx + dy * dy > sim_radius_ * sim_radius_)
             {
-                if (rng_->get_uniform() < vitals_.to_hit)
-                {
-                    std::printf("Attacked player!\n");
-                    targ_sptr->take_damage(vitals_.damage);
-                    if (on_did != nullptr)
-                        on_did(shared_from_this(), entity::did_attack, targ_sptr);
-                }
-                else
+                if (asleep_[h.index] == 0)
+                    asleep_[h.index] = turn_;
+                continue;
+            }
+
+            if (asleep_[h.index] != 0)
+            {
+                catch_up(h, on_did);
+                asleep_[h.index] = 0;
+                caught_up = true;
+            }
+            awake_.push_back(h);
+        }
+
+        if (caught_up)
+            find_near_target();
+    }
+
+    // Replays a root's missed spawns, a turn at a time while it has spawns
+    // left and then skipping to the end of each cooldown, using the rolls it
+    // would have made then. Seeds dropped long enough ago are placed as what
+    // they'd have grown into, the rest wake up when they would have. The
+    // root ends up as far into its cooldown as it would be.
+    void catch_up(handle h, const on_did_func &on_did)
+    {
+        auto &root = plant_archetypes[pt_root];
+        // It could spawn from when it fell asleep, or its cooldown ran out.
+        auto t = std::max(asleep_[h.index], wake_[h.index]);
+        while (t < turn_)
+        {
+            if (growth_count_[h.index] <= 0)
+                growth_count_[h.index] = root.growth_count;
+            catch_up_.adds.clear();
+            // Nowhere left to grow, it's been ready to since.
+            if (!spawn_root(h, catch_up_, t))
+                break;
+            spawned_something(h, catch_up_, t);
+
+            for (auto &el : catch_up_.adds)
+            {
+                auto &arch = plant_archetypes[el.type];
+                auto grows = t + arch.timer;
+                bool grown = grows <= turn_ && arch.grows_into != pt_none;
+                auto pl = add(grown ? arch.grows_into : el.type, el.coord, el.parent);
+                if (!pl)
+                    continue;
+                if (!grown && arch.timer > 0)
                 {
-                    if (on_did != nullptr)
-                        on_did(shared_from_this(), entity::did_miss, targ_sptr);
+                    wake_[pl.index] = grows;
+                    wakes_.schedule(pl, grows);
                 }
+                if (on_did != nullptr)
+                    on_did(pl, entity::did_spawn, el.parent);
             }
+            update_frontier();
+
+            if (growth_count_[h.index] > 0)
+                ++t;
+            else
+                t = std::max(t + 1, wake_[h.index]);
         }
+        catch_up_.wakes.clear();
+
+        if (t > turn_)
+            wakes_.schedule(h, wake_[h.index]);
+        else if (growth_count_[h.index] <= 0)
+            growth_count_[h.index] = root.growth_count;
     }
 
-    virtual void spawn(on_did_func on_did)
+    void mark_active(handle h)
     {
-        (void)on_did;
+        if (acted_[h.index] == turn_)
+            return;
+        acted_[h.index] = turn_;
+        active_.push_back(h);
+    }
+
+    // Buckets plants by chunk, keeping the order they're listed in. Sizes
+    // the chunks to the map the first time.
+    template <class List>
+    void split_into_chunks(const List &plants)
+    {
+        size_t wide = (entities_->get_width() + chunk_size - 1) / chunk_size;
+        size_t high = (entities_->get_height() + chunk_size - 1) / chunk_size;
+        if (wide != chunks_wide_ || wide * high != chunks_.size())
+        {
+            chunks_wide_ = wide;
+            chunks_.clear();
+            for (size_t i = 0; i < wide * high; ++i)
+                chunks_.emplace_back(new chunk());
+        }
 
-        if (auto parentsptr = parent_.lock())
+        for (auto &c : chunks_)
         {
-            if (!parentsptr->can_spawn_more())
-                return;
+            c->plants.clear();
+            c->events.clear();
+            c->attackers.clear();
+            c->dels.clear();
+            c->grows.clear();
+            c->adds.clear();
+            c->wakes.clear();
+        }
 
-            auto targ_sptr = target_.lock();
-            auto distance = distance_between(shared_from_this(), targ_sptr);
-            weak_ptr final_target = shared_from_this();
-            if (targ_sptr && distance && *distance < 6.0)
-                final_target = targ_sptr;
+        for (auto h : plants)
+        {
+            auto coord = entities_->get_coord(h);
+            auto i = (coord.second / chunk_size) * chunks_wide_ + coord.first / chunk_size;
+            chunks_[i]->plants.push_back(h);
+        }
+    }
 
-            auto empty = empty_neighbors(final_target);
-            if (empty.size() > 0)
+    void run_chunks(const std::function<void(chunk &)> &fn)
+    {
+        // Pages shared with a clone get copied on first write, which two
+        // chunks mustn't race to do. Only the pages holding the rows the
+        // chunks write to are copied, up front.
+        if (pool_->get_workers() > 0)
+        {
+            for (auto &c : chunks_)
             {
-                std::printf("vine spawning\n");
-                auto r = rng_->get_range(0, empty.size() - 1);
-                grow_something<seed>(int_pair(empty[r].first, empty[r].second), shared_from_this(), "vine");
-                parentsptr->spawned_something();
+                for (auto h : c->plants)
+                {
+                    wake_.unshare(h.index);
+                    growth_count_.unshare(h.index);
+                }
             }
         }
+
+        pool_->run(chunks_.size(), [&](size_t i)
+        {
+            if (!chunks_[i]->plants.empty())
+                fn(*chunks_[i]);
+        });
     }
 
-protected:
-};
+    handle target_handle() const { return target_ ? target_->get_handle() : handle(); }
 
-/*
-1a. If growing
-  1. Increment growth period for all plants growing
-  2. If done growing
-    1. Add plants on growth list to plant list
-    2. Set to not growing
-1b. If not growing
-  1. Find N plants on the outer edges of the whole plant group.
-  2a. Check if upgrade, or grow
-    1. Replace and set new plant to grow
-  2b. If grow instead
-    1. Find target to grow, if none, pick random area unnoccupied.
-  3. Add to growing list.
-2. Update all plants to do something to target. (attack)
-*/
+    bool can_spawn_more(handle h) const
+    {
+        // Only roots keep track, growth count has to be above 0.
+        return is_plant(h) && type_[h.index] == pt_root && growth_count_[h.index] > 0;
+    }
 
-class root : public plant, private boost::noncopyable
-{
-public:
-    root(region *reg, rng *r, sparse_2d_map<entity> *pm, weak_ptr target) :
-        plant(reg, r, "root", pm, target, std::weak_ptr<plant>())
+    void spawned_something(handle h, chunk &c, uint32_t turn)
     {
-        growth_cooldown_ = 3;
-        growth_count_ = 1;
+        if (get_type(h) != pt_root)
+            return;
+        // When limit reached, set the time for next spawn.
+        if (--growth_count_[h.index] <= 0)
+        {
+            wake_[h.index] = turn + plant_archetypes[pt_root].timer;
+            c.wakes.push_back(h);
+        }
     }
-    virtual ~root() { }
 
-    virtual bool can_spawn_more() const
+    // Dead plants report it and go away at the end of the pass.
+    bool act_dead(handle h, chunk &c) const
     {
-        // Growth count has to be above 0.
-        return growth_count_ > 0;
+        if (vitals_[h.index].hearts > 0)
+            return false;
+        c.events.push_back({h, entity::did_die, handle()});
+        c.dels.push_back(h);
+        return true;
     }
 
-    virtual void spawned_something()
+    void act_seed(handle h, chunk &c) const
     {
-        // When limit reached, set the time for next spawn.
-        if (--growth_count_ <= 0)
-            growth_cooldown_ = 3;
+        auto into = plant_archetypes[pt_seed].grows_into;
+        if (wake_[h.index] == turn_ && into != pt_none)
+            c.grows.push_back({h, into});
     }
 
-    virtual void act(on_did_func on_did)
+    // Vines straight up, down, left or right of the target attack it once
+    // the pass is over.
+    void act_vine(handle h, chunk &c) const
     {
-        if (is_dead())
+        auto at = entities_->get_coord(h);
+        auto targ = reach_.get_origin();
+        if (reach_.at(at) == 1 && (at.first == targ.first || at.second == targ.second))
         {
-            on_did(shared_from_this(), entity::did_die, weak_ptr());
-            entities_->del_ptr_later(shared_from_this());
-            return;
+            auto r = rng_->stream(turn_, h.generation);
+            c.attackers.push_back({h, r.get_uniform() < vitals_[h.index].to_hit});
         }
+    }
 
-        if (--growth_cooldown_ <= 0)
-            growth_count_ = 1;
+    void attack_target(const attack &a, const on_did_func &on_did)
+    {
+        auto h = a.h;
+        auto targ = target_handle();
+        if (a.hit)
+        {
+            target_->take_damage(vitals_[h.index].damage);
+            if (on_did != nullptr)
+                on_did(h, entity::did_attack, targ);
+        }
+        else
+        {
+            if (on_did != nullptr)
+                on_did(h, entity::did_miss, targ);
+        }
     }
 
-    virtual void spawn(on_did_func on_did)
+    void act_root(handle h)
     {
-        (void)on_did;
-        if (!can_spawn_more())
-            return;
+        if (wake_[h.index] == turn_)
+            growth_count_[h.index] = plant_archetypes[pt_root].growth_count;
+    }
 
-        auto targ_sptr = target_.lock();
-        auto distance = distance_between(shared_from_this(), targ_sptr);
-        weak_ptr final_target = shared_from_this();
-        if (targ_sptr && distance && *distance < 6.0)
-            final_target = targ_sptr;
+    // Rolls as if it were the given turn. True if it spawned something, the
+    // caller counts it with spawned_something().
+    bool spawn_root(handle h, chunk &c, uint32_t turn) const
+    {
+        if (!can_spawn_more(h))
+            return false;
+
+        // The root's vines creep towards the target when they're close to
+        // it, otherwise grow from a random spot on the colony's edge. The
+        // root only grows by itself when none of them can.
+        auto r = rng_->stream(turn, h.generation);
+        auto targ = target_handle();
+        if (entities_->exists(targ) && entities_->get_open(entities_->get_coord(targ)) != 0)
+        {
+            for (auto v : near_)
+            {
+                if (parent_[v.index] == h && grow_closer(v, targ, c, r))
+                    return true;
+            }
+        }
+
+        auto &edge = frontier_[h.index];
+        if (!edge.empty())
+        {
+            auto v = edge[r.get_range(0, edge.size() - 1)];
+            if (grow_seed(v, v, c, r))
+                return true;
+        }
+
+        bool close = reach_.at(entities_->get_coord(h)) != distance_field::unreached;
+        return grow_seed(h, close ? targ : h, c, r);
+    }
 
-        auto empty = empty_neighbors(final_target);
+    // Drops a seed of spawner's on a random open tile next to around.
+    bool grow_seed(handle spawner, handle around, chunk &c, rng_stream &r) const
+    {
+        auto &empty = empty_neighbors(around, c.neighbors);
         if (empty.size() > 0)
         {
-            std::printf("root spawning\n");
-            auto r = rng_->get_range(0, empty.size() - 1);
-            grow_something<seed>(int_pair(empty[r].first, empty[r].second), shared_from_this(), "vine");
-            spawned_something();
+            auto i = r.get_range(0, empty.size() - 1);
+            c.adds.push_back({pt_seed, empty[i], spawner});
+            return true;
         }
+        return false;
     }
 
-protected:
-    int growth_cooldown_;
-    int growth_count_;
+    // Drops a seed of v's on an open tile next to it that's a step closer
+    // to the target, or next to the target once v is beside it.
+    bool grow_closer(handle v, handle targ, chunk &c, rng_stream &r) const
+    {
+        auto d = reach_.at(entities_->get_coord(v));
+        if (d <= 1)
+            return grow_seed(v, targ, c, r);
+
+        auto &closer = c.neighbors;
+        empty_neighbors(v, closer);
+        closer.erase(std::remove_if(closer.begin(), closer.end(),
+            [&](const int_pair &n) { return reach_.at(n) >= d; }), closer.end());
+        if (closer.empty())
+            return false;
+        c.adds.push_back({pt_seed, closer[r.get_range(0, closer.size() - 1)], v});
+        return true;
+    }
 };
 
 #endif
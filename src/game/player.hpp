@@ -17,10 +17,8 @@ struct attributes
 class player : public entity, private boost::noncopyable
 {
 private:
-    using weak_ptr = std::weak_ptr<entity>;
-    using shared_ptr = std::shared_ptr<entity>;
     using int_pair = std::pair<int, int>;
-    using on_did_func = std::function<void(weak_ptr src, entity::did did, weak_ptr targ)>;
+    using on_did_func = std::function<void(handle src, entity::did did, handle targ)>;
 public:
     enum action
     {
@@ -32,20 +30,29 @@ public:
         act_item
     };
 
-    player(region *reg, rng *r, sparse_2d_map<entity> *pm) :
-        entity(reg, r), entities_(pm)
+    player(region *reg, rng *r, sparse_2d_map *pm, plant_store *ps) :
+        entity(reg, r), entities_(pm), plants_(ps)
     {
         vitals_ = {2, 3, 2, 0.66};
         attributes_ = {2, 3};
     }
     virtual ~player() { }
 
+    // The same player in a copy of the level.
+    std::unique_ptr<player> clone(region *reg, rng *r, sparse_2d_map *pm, plant_store *ps) const
+    {
+        std::unique_ptr<player> c(new player(reg, r, pm, ps));
+        c->vitals_ = vitals_;
+        c->attributes_ = attributes_;
+        c->self_ = self_;
+        return c;
+    }
+
     virtual void perform(int_pair delta, player::action act, on_did_func on_did)
     {
-        auto p = entities_->get_this_ptr(this);
-        if (auto sptr = p.lock())
+        if (entities_->exists(get_handle()))
         {
-            auto loc = entities_->get_coord(sptr);
+            auto loc = entities_->get_coord(get_handle());
             perform_to({loc.first + delta.first, loc.second + delta.second}, act, on_did);
         }
     }
@@ -59,14 +66,13 @@ public:
         case player::act_move:
             if (region_->in_bounds(x, y) && region_->tile_at(x, y) >= t_floor)
             {
-                auto pl = entities_->get_ptr({x, y});
-                auto sptr = pl.lock();
+                auto pl = entities_->get_handle({x, y});
                 // Move to location, nothing is there.
-                if (!sptr)
+                if (!pl)
                 {
-                    entities_->move_ptr_to(entities_->get_this_ptr(this).lock(), {x, y});
+                    entities_->move_to(get_handle(), {x, y});
                     if (on_did != nullptr)
-                        on_did(entities_->get_this_ptr(this), entity::did_move, shared_ptr());
+                        on_did(get_handle(), entity::did_move, handle());
 
                 }
                 // Attack (default).
@@ -74,16 +80,14 @@ public:
                 {
                     if (rng_->get_uniform() < vitals_.to_hit)
                     {
-                        std::printf("Dealt %d damage\n", vitals_.damage);
-                        sptr->take_damage(vitals_.damage);
+                        plants_->take_damage(pl, vitals_.damage);
                         if (on_did != nullptr)
-                            on_did(entities_->get_this_ptr(this), entity::did_attack, pl);
+                            on_did(get_handle(), entity::did_attack, pl);
                     }
                     else
                     {
-                        std::printf("Missed.\n");
                         if (on_did != nullptr)
-                            on_did(entities_->get_this_ptr(this), entity::did_miss, pl);
+                            on_did(get_handle(), entity::did_miss, pl);
                     }
                 }
             }
@@ -99,7 +103,8 @@ public:
     virtual attributes &get_attributes() { return attributes_; }
 
 protected:
-    sparse_2d_map<entity> *entities_;
+    sparse_2d_map *entities_;
+    plant_store *plants_;
     attributes attributes_;
 };
 
@@ -2,14 +2,115 @@
 #ifndef RANDOM_HPP
 #define RANDOM_HPP
 
+#include <algorithm>
+#include <cstdint>
 #include <ctime>
 #include <random>
 
-class rng
+// get_uniform/get_range/fill_uniform on top of anything with a next() that
+// returns 64 random bits.
+template <class G>
+class uniform_draws
+{
+public:
+    // [0, 1).
+    double get_uniform()
+    {
+        return (self().next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // [min, max].
+    ssize_t get_range(ssize_t min, ssize_t max)
+    {
+        uint64_t span = static_cast<uint64_t>(max - min) + 1;
+        if (span == 0)
+            return static_cast<ssize_t>(self().next());
+
+        // Throws away the top few values so every outcome is as likely.
+        uint64_t limit = -span % span;
+        uint64_t x;
+        do
+            x = self().next();
+        while (x < limit);
+        return min + static_cast<ssize_t>(x % span);
+    }
+
+    template <class I>
+    void fill_uniform(I first, I last)
+    {
+        for (; first != last; ++first)
+            *first = get_uniform();
+    }
+
+private:
+    G &self() { return static_cast<G &>(*this); }
+};
+
+// Philox4x32-10, a counter-based generator: the numbers are a pure function
+// of the key and the counter, so nothing has to be shared or drawn in order.
+inline void philox4x32(const uint32_t key[2], const uint32_t ctr[4], uint32_t out[4])
+{
+    uint32_t k0 = key[0], k1 = key[1];
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    for (int round = 0; round < 10; ++round)
+    {
+        uint64_t p0 = static_cast<uint64_t>(0xD2511F53) * c0;
+        uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57) * c2;
+        c0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+        c1 = static_cast<uint32_t>(p1);
+        c2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+        c3 = static_cast<uint32_t>(p0);
+        k0 += 0x9E3779B9;
+        k1 += 0xBB67AE85;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// The numbers one entity gets on one turn. Two streams with the same seed,
+// turn and id draw the same numbers, whichever thread and order they're
+// drawn in.
+class rng_stream : public uniform_draws<rng_stream>
+{
+public:
+    rng_stream(uint64_t seed, uint32_t turn, uint32_t id) :
+        draw_(0), used_(4)
+    {
+        key_[0] = static_cast<uint32_t>(seed);
+        key_[1] = static_cast<uint32_t>(seed >> 32);
+        ctr_[0] = 0;
+        ctr_[1] = 0;
+        ctr_[2] = turn;
+        ctr_[3] = id;
+    }
+
+    uint64_t next()
+    {
+        if (used_ == 4)
+        {
+            ctr_[0] = draw_++;
+            philox4x32(key_, ctr_, block_);
+            used_ = 0;
+        }
+        uint64_t x = static_cast<uint64_t>(block_[used_]) << 32 | block_[used_ + 1];
+        used_ += 2;
+        return x;
+    }
+
+private:
+    uint32_t key_[2];
+    uint32_t ctr_[4];
+    uint32_t block_[4];
+    uint32_t draw_;
+    int used_;
+};
+
+class rng : public uniform_draws<rng>
 {
 public:
     rng(size_t seed=0)
-        : gen_(rd_())
     {
         set_seed(seed);
     }
@@ -19,26 +120,22 @@ public:
     {
         if (!seed)
             seed = std::time(nullptr);
+        seed_ = seed;
         gen_.seed(seed);
     }
 
-    double get_uniform()
-    {
-        std::uniform_real_distribution<double> dis(0, 1);
-        return dis(gen_);
-    }
+    uint64_t next() { return gen_(); }
 
-    ssize_t get_range(ssize_t min, ssize_t max)
+    // Independent of everything drawn from this rng so far.
+    rng_stream stream(uint32_t turn, uint32_t id) const
     {
-        std::uniform_int_distribution<ssize_t> dis(min, max);
-        return dis(gen_);
+        return rng_stream(seed_, turn, id);
     }
 
     template <class I>
     void shuffle(I first, I last) { std::shuffle(first, last, gen_); }
 private:
     size_t seed_;
-    std::random_device rd_;
     std::mt19937_64 gen_;
 };
 
@@ -3,6 +3,7 @@
 #define REGION_HPP
 
 #include <iostream>
+#include <memory>
 #include <tuple>
 #include <vector>
 
@@ -35,23 +36,39 @@ class region : private boost::noncopyable
 private:
     using int_pair = std::pair<int, int>;
 public:
-    region() : width_(0), height_(0), drunk_(nullptr) { }
+    region() : width_(0), height_(0), version_(0), drunk_(nullptr), tiles_(new std::vector<tile>()) { }
     ~region()
     {
         if (drunk_)
             drunkard_destroy(drunk_);
     }
 
-    void generate(size_t width, size_t height)
+    // Shares the tiles with this one, they're only ever written by
+    // generate(), which gives the region its own copy first. A clone can't
+    // hand out random coordinates until it generates a map of its own.
+    std::unique_ptr<region> clone() const
     {
-        tiles_.resize(width * height, t_rocks);
+        std::unique_ptr<region> c(new region());
+        c->width_ = width_;
+        c->height_ = height_;
+        c->version_ = version_;
+        c->tiles_ = tiles_;
+        return c;
+    }
+
+    // A seed of 0 picks one from the clock.
+    void generate(size_t width, size_t height, unsigned seed=0)
+    {
+        if (tiles_.use_count() > 1)
+            tiles_.reset(new std::vector<tile>(*tiles_));
+        tiles_->resize(width * height, t_rocks);
 
         if (drunk_)
             drunkard_destroy(drunk_);
 
-        drunk_ = drunkard_create((unsigned *)tiles_.data(), width, height);
+        drunk_ = drunkard_create((unsigned *)tiles_->data(), width, height);
         drunkard_set_open_threshold(drunk_, t_floor);
-        drunkard_seed(drunk_, time(nullptr));
+        drunkard_seed(drunk_, seed ? seed : time(nullptr));
 
         // Carve seed.
         drunkard_start_fixed(drunk_, width / 2, height / 2);
@@ -76,6 +93,7 @@ public:
 
         width_ = width;
         height_ = height;
+        ++version_;
 
         for (size_t y = 0; y < height; ++y)
         {
@@ -99,18 +117,20 @@ public:
 
     size_t get_width() const { return width_; }
     size_t get_height() const { return height_; }
+    // Goes up every time the tiles change, a clone starts out the same.
+    unsigned get_version() const { return version_; }
 
     bool walkable(int x, int y) const { return tile_at(x, y) >= t_floor; }
     bool in_bounds(int x, int y) const
     { return x >= 0 && x < (int)width_ && y >= 0 && y < (int)height_; }
-    const tile &tile_at(int x, int y) const { return tiles_[y * width_ + x]; }
-    tile &tile_at(int x, int y) { return tiles_[y * width_ + x]; }
+    const tile &tile_at(int x, int y) const { return (*tiles_)[y * width_ + x]; }
 
 private:
     size_t width_;
     size_t height_;
+    unsigned version_;
     drunkard *drunk_;
-    std::vector<tile> tiles_;
+    std::shared_ptr<std::vector<tile>> tiles_;
 };
 
 #endif
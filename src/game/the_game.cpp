@@ -0,0 +1,143 @@
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include <the_game.hpp>
+
+the_game::the_game(on_did_func on_did, size_t seed, size_t workers) :
+    on_did_(on_did), rng_(seed), pool_(workers)
+{
+    the_region_.reset(new region());
+    entity_manager_.reset(new sparse_2d_map());
+    plants_.reset(new plant_store(the_region_.get(), &rng_, entity_manager_.get(), &pool_));
+    the_player_.reset(new player(the_region_.get(), &rng_, entity_manager_.get(), plants_.get()));
+    paths_.reset(new pathfinder(entity_manager_.get(), false));
+    plants_->set_target(the_player_.get());
+    level_ = 0;
+    level_width_ = 20;
+    level_height_ = 20;
+    reset();
+}
+
+the_game::the_game(const the_game &from, on_did_func on_did) :
+    on_did_(on_did), rng_(from.rng_), pool_(0), level_(from.level_),
+    level_width_(from.level_width_), level_height_(from.level_height_)
+{
+    the_region_ = from.the_region_->clone();
+    entity_manager_ = from.entity_manager_->clone();
+    plants_ = from.plants_->clone(the_region_.get(), &rng_, entity_manager_.get(), &pool_);
+    the_player_ = from.the_player_->clone(the_region_.get(), &rng_, entity_manager_.get(), plants_.get());
+    paths_.reset(new pathfinder(entity_manager_.get(), false));
+    plants_->set_target(the_player_.get());
+}
+
+std::unique_ptr<the_game> the_game::clone(on_did_func on_did) const
+{
+    return std::unique_ptr<the_game>(new the_game(*this, on_did));
+}
+
+void the_game::reset()
+{
+    the_region_->generate(level_width_, level_height_, rng_.get_range(1, UINT32_MAX));
+    auto loc = the_region_->get_random_empty_coord();
+    // Levels the same size as the last reuse its tables, so only the
+    // terrain gets rewritten.
+    auto w = the_region_->get_width(), h = the_region_->get_height();
+    if (entity_manager_->get_width() != w || entity_manager_->get_height() != h)
+        entity_manager_->resize(w, h);
+    else
+        entity_manager_->clear();
+    entity_manager_->set_terrain(*the_region_);
+    plants_->clear();
+    plants_->reserve(the_region_->get_width() * the_region_->get_height());
+    the_player_->set_handle(entity_manager_->add({loc.first, loc.second}));
+
+    auto set = settings[level_];
+    plants_->set_sim_radius(set.sim_radius);
+    for (ssize_t i = 0; i < set.number_of_roots; ++i)
+    {
+        auto v = the_region_->get_random_empty_coord();
+        if (v.first != loc.first && v.second != loc.second)
+            plants_->add(pt_root, {v.first, v.second}, handle());
+    }
+}
+
+void the_game::player_act(ssize_t dx, ssize_t dy, player::action act)
+{
+    the_player_->perform({dx, dy}, act, on_did_);
+}
+
+const std::vector<std::pair<int, int>> &the_game::find_path(std::pair<int, int> to)
+{
+    return paths_->find(player_coord(), to);
+}
+
+void the_game::rest_act()
+{
+    plants_->act(on_did_);
+    plants_->add_plants(on_did_);
+    plants_->del_plants();
+    plants_->spawn(on_did_);
+    plants_->add_plants(on_did_);
+    plants_->del_plants();
+}
+
+void the_game::begin_rest_act()
+{
+    finish_rest_act();
+
+    view_ = clone();
+    events_.clear();
+    saved_on_did_ = on_did_;
+    on_did_ = [this](handle src, entity::did did, handle targ)
+    {
+        events_.push_back({src, did, targ});
+    };
+    turn_ = std::async(std::launch::async, [this] { rest_act(); });
+}
+
+void the_game::finish_rest_act()
+{
+    if (!turn_.valid())
+        return;
+    turn_.get();
+
+    on_did_ = saved_on_did_;
+    view_.reset();
+    if (on_did_ != nullptr)
+        for (auto &e : events_)
+            on_did_(e.src, e.did, e.targ);
+    events_.clear();
+}
+
+step_summary the_game::step(size_t n, const std::vector<turn_action> &script)
+{
+    finish_rest_act();
+
+    step_summary sum;
+    std::memset(&sum, 0, sizeof(sum));
+
+    on_did_func counted = [&](handle src, entity::did did, handle)
+    {
+        if (src == the_player_->get_handle())
+            ++sum.by_player[did];
+        else
+            ++sum.by_plants[did];
+    };
+    std::swap(on_did_, counted);
+
+    while (sum.turns < n && the_player_->is_alive())
+    {
+        if (sum.turns < script.size() && script[sum.turns].act != player::act_none)
+        {
+            auto &a = script[sum.turns];
+            player_act(a.dx, a.dy, a.act);
+        }
+        rest_act();
+        ++sum.turns;
+    }
+
+    std::swap(on_did_, counted);
+    return sum;
+}
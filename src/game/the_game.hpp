@@ -3,14 +3,17 @@
 #define THE_GAME_HPP
 
 #include <boost/noncopyable.hpp>
+#include <future>
 #include <map>
 #include <vector>
 
 #include <random.hpp>
 #include <region.hpp>
 #include <entity.hpp>
+#include <pathfinder.hpp>
 #include <plants.hpp>
 #include <player.hpp>
+#include <thread_pool.hpp>
 
 struct level_settings
 {
@@ -18,97 +21,140 @@ struct level_settings
     double chance_to_be_good;
     double chance_to_be_neutral;
     double chance_to_be_evil;
+    // Roots farther than this from the player sit out until it comes
+    // back, 0 keeps all of them going. Catching up is close to but not
+    // quite what would have happened, so it's off unless a level is too
+    // big to run whole.
+    ssize_t sim_radius;
 };
 
 static constexpr level_settings settings[] = {
-    {1, 0.8, 0.0, 0.1},
+    {1, 0.8, 0.0, 0.1, 0},
 };
 
 static constexpr ssize_t max_levels = 1;
 
+// One scripted player turn for the_game::step.
+struct turn_action
+{
+    ssize_t dx;
+    ssize_t dy;
+    player::action act;
+};
+
+// What happened over a the_game::step, counted instead of reported one
+// at a time.
+struct step_summary
+{
+    size_t turns;
+    // Indexed by entity::did.
+    size_t by_player[entity::did_count];
+    size_t by_plants[entity::did_count];
+};
+
+// The whole simulation, no window or SFML needed. Built into its own
+// library (see SConstruct) so it can be driven headless.
 class the_game : private boost::noncopyable
 {
 public:
-    the_game(std::function<void(std::weak_ptr<entity> src, entity::did did, std::weak_ptr<entity> targ)> on_did) :
-        on_did_(on_did)
-    {
-        the_region_.reset(new region());
-        entity_manager_.reset(new sparse_2d_map<entity>());
-        the_player_ = std::make_shared<player>(the_region_.get(), &rng_, entity_manager_.get());
-        level_ = 0;
-        reset();
-    }
-
-    void reset()
-    {
-        the_region_->generate(20, 20);
-        auto loc = the_region_->get_random_empty_coord();
-        entity_manager_->clear();
-        entity_manager_->add_ptr(the_player_, {0, 0});
-        the_player_->perform_to({loc.first, loc.second}, player::act_move, nullptr);
-
-        auto set = settings[level_];
-        for (ssize_t i = 0; i < set.number_of_roots; ++i)
-        {
-            auto v = the_region_->get_random_empty_coord();
-            if (v.first != loc.first && v.second != loc.second)
-            {
-                auto r = new root(the_region_.get(), &rng_, entity_manager_.get(), the_player_);
-                entity_manager_->add_ptr(std::shared_ptr<plant>(r), {v.first, v.second});
-            }
-        }
-    }
+    using on_did_func = std::function<void(handle src, entity::did did, handle targ)>;
 
-    const region &get_region() const { return *the_region_.get(); }
-    const player &get_player() const { return *the_player_.get(); }
+    // The same seed plays out the same game, 0 picks one from the clock.
+    // workers is how many extra threads the plants get each turn, pass 0
+    // when running lots of games side by side.
+    the_game(on_did_func on_did, size_t seed=0, size_t workers=thread_pool::default_workers());
 
-    void player_act(ssize_t dx, ssize_t dy, player::action act)
+    void reset();
+    // Levels from the next reset() on are width x height, 20 x 20 unless
+    // this is called.
+    void set_level_size(size_t width, size_t height)
     {
-        the_player_->perform({dx, dy}, act, on_did_);
+        level_width_ = width;
+        level_height_ = height;
     }
 
-    void rest_act()
-    {
-        for (auto &p : *entity_manager_)
-        {
-            if (auto cast = std::dynamic_pointer_cast<plant>(p.second))
-                cast->act(on_did_);
-        }
-        entity_manager_->add_ptrs();
-        entity_manager_->del_ptrs();
-        for (auto &p : *entity_manager_)
-        {
-            if (auto cast = std::dynamic_pointer_cast<plant>(p.second))
-                cast->spawn(on_did_);
-        }
-        entity_manager_->add_ptrs();
-        entity_manager_->del_ptrs();
-    }
+    // A copy of the game as it stands, for trying out moves. Tiles, the
+    // entity map and the plant columns are shared with this game until
+    // either side changes them, so a clone is cheap to make and to play a
+    // few turns ahead on. The clone's plants run on the calling thread.
+    std::unique_ptr<the_game> clone(on_did_func on_did=nullptr) const;
+
+    const region &get_region() const { return *the_region_.get(); }
+    const player &get_player() const { return *the_player_; }
+    handle get_player_handle() const { return the_player_->get_handle(); }
+    const plant_store &get_plants() const { return *plants_; }
+    plant_store &get_plants() { return *plants_; }
+
+    void player_act(ssize_t dx, ssize_t dy, player::action act);
+    void rest_act();
+
+    // rest_act() on another thread, for running the world's turn while the
+    // player's move is still being animated. Until finish_rest_act(), only
+    // get_view() may be looked at, the game itself is being written to.
+    void begin_rest_act();
+    // Waits for the turn if it's still going, then makes it visible and
+    // reports what happened during it through on_did.
+    void finish_rest_act();
+    // The game as of begin_rest_act() while a turn is running, the game
+    // itself otherwise.
+    const the_game &get_view() const { return view_ ? *view_ : *this; }
+
+    // Runs up to n whole turns back to back, stopping early if the player
+    // dies. On turn i the player does script[i], or nothing past the end of
+    // it (or for act_none). on_did isn't called, the events are counted
+    // in the summary instead.
+    step_summary step(size_t n, const std::vector<turn_action> &script=std::vector<turn_action>());
 
     std::pair<int, int> player_coord()
     {
-        return entity_manager_->get_coord(the_player_);
+        return entity_manager_->get_coord(the_player_->get_handle());
     }
 
-    std::weak_ptr<entity> get_entity_at(ssize_t x, ssize_t y) const { return entity_manager_->get_ptr({x, y}); }
-    bool get_entity_coord(std::weak_ptr<entity> pl, std::pair<int, int> &v) const
+    // The steps from the player to coord, see pathfinder::find. Only ever
+    // straight up, down, left or right, like the player's own moves. Only
+    // while no turn is running in the background.
+    const std::vector<std::pair<int, int>> &find_path(std::pair<int, int> to);
+
+    handle get_entity_at(ssize_t x, ssize_t y) const { return entity_manager_->get_handle({x, y}); }
+    bool get_entity_coord(handle h, std::pair<int, int> &v) const
     {
-        if (entity_manager_->exists(pl.lock()))
+        if (entity_manager_->exists(h))
         {
-            v = entity_manager_->get_coord(pl.lock());
+            v = entity_manager_->get_coord(h);
             return true;
         }
         return false;
     }
 
 private:
+    struct event
+    {
+        handle src;
+        entity::did did;
+        handle targ;
+    };
+
+    the_game(const the_game &from, on_did_func on_did);
+
     std::unique_ptr<region> the_region_;
-    std::unique_ptr<sparse_2d_map<entity>> entity_manager_;
-    std::shared_ptr<player> the_player_;
-    std::function<void(std::weak_ptr<entity> src, entity::did did, std::weak_ptr<entity> targ)> on_did_;
+    std::unique_ptr<sparse_2d_map> entity_manager_;
+    std::unique_ptr<plant_store> plants_;
+    std::unique_ptr<player> the_player_;
+    std::unique_ptr<pathfinder> paths_;
+    on_did_func on_did_;
 
     rng rng_;
+    thread_pool pool_;
     ssize_t level_;
+    size_t level_width_;
+    size_t level_height_;
+
+    // While a turn runs in the background.
+    std::unique_ptr<the_game> view_;
+    std::vector<event> events_;
+    on_did_func saved_on_did_;
+    // Last, so it's waited on before anything else goes away.
+    std::future<void> turn_;
 };
 
 #endif
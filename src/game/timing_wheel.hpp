@@ -0,0 +1,83 @@
+
+#ifndef TIMING_WHEEL_HPP
+#define TIMING_WHEEL_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <handle.hpp>
+
+// Wake-up calls by turn. Anything due within the next `slots` turns sits in
+// the bucket for its turn, anything later waits in one overflow list that's
+// only looked at once per trip around the wheel. Advancing a turn costs as
+// much as what's due on it.
+//
+// Nothing is ever cancelled, whoever gets woken up checks it still cares.
+class timing_wheel
+{
+private:
+    static constexpr uint32_t slots = 64;
+
+    struct entry
+    {
+        handle h;
+        uint32_t turn;
+    };
+public:
+    timing_wheel() : now_(0), wheel_(slots) { }
+
+    // Forgets everything, the next turn advanced to is now + 1.
+    void clear(uint32_t now=0)
+    {
+        now_ = now;
+        for (auto &bucket : wheel_)
+            bucket.clear();
+        far_.clear();
+    }
+
+    // Turns at or before the current one are due on the next.
+    void schedule(handle h, uint32_t turn)
+    {
+        if (turn <= now_)
+            turn = now_ + 1;
+        if (turn - now_ < slots)
+            wheel_[turn % slots].push_back({h, turn});
+        else
+            far_.push_back({h, turn});
+    }
+
+    // Moves on to turn, adding everything that came due on the way to due.
+    void advance(uint32_t turn, std::vector<handle> &due)
+    {
+        while (now_ < turn)
+        {
+            ++now_;
+            auto &bucket = wheel_[now_ % slots];
+
+            // A trip around, pull in what's coming up in the next one.
+            if (now_ % slots == 0 && !far_.empty())
+            {
+                size_t kept = 0;
+                for (auto &e : far_)
+                {
+                    if (e.turn - now_ < slots)
+                        wheel_[e.turn % slots].push_back(e);
+                    else
+                        far_[kept++] = e;
+                }
+                far_.resize(kept);
+            }
+
+            for (auto &e : bucket)
+                due.push_back(e.h);
+            bucket.clear();
+        }
+    }
+
+private:
+    uint32_t now_;
+    std::vector<std::vector<entry>> wheel_;
+    std::vector<entry> far_;
+};
+
+#endif
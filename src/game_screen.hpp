@@ -3,6 +3,7 @@
 #define GAME_HPP
 
 #include <boost/noncopyable.hpp>
+#include <cmath>
 #include <unordered_map>
 #include <vector>
 
@@ -13,6 +14,8 @@
 #include <game/the_game.hpp>
 #include <utils/animation_manager.hpp>
 #include <utils/resource_manager.hpp>
+#include <utils/sprite_batch.hpp>
+#include <utils/texture_atlas.hpp>
 #include <ui/simple_ui.hpp>
 
 static constexpr double tiles_per_screen = 5.0;
@@ -21,11 +24,6 @@ static constexpr double turn_length_s = 0.5;
 
 class player_controller
 {
-private:
-    using weak_ptr = std::weak_ptr<entity>;
-    using weak_const_ptr = std::weak_ptr<const entity>;
-    using shared_ptr = std::shared_ptr<entity>;
-    using shared_const_ptr = std::shared_ptr<const entity>;
 public:
     player_controller(the_game *tg, resource_manager *sm) :
         the_game_(tg), sprite_manager_(sm)
@@ -50,10 +48,19 @@ public:
         player_coord_ = {loc.first * tile_size, loc.second * tile_size};
         player_destination_ = {loc.first * tile_size, loc.second * tile_size};
         player_moving_ = false;
+        walking_ = false;
     }
 
     virtual ~player_controller() { }
 
+    // Walks the player to coord a turn at a time, hitting whatever gets in
+    // the way. Any key stops it.
+    void walk_to(std::pair<int, int> coord)
+    {
+        walking_ = true;
+        walk_goal_ = coord;
+    }
+
     const sf::Vector2f &get_coord() const { return player_coord_; }
     const state_animator &get_animator() const { return player_anim_; }
 
@@ -83,8 +90,36 @@ public:
                 dx = 1;
                 dy = 0;
             }
+
             if (dx != 0 || dy != 0)
+            {
+                walking_ = false;
+            }
+            else if (walking_)
+            {
+                auto &path = the_game_->find_path(walk_goal_);
+                if (!path.empty())
+                {
+                    auto loc = the_game_->player_coord();
+                    dx = path[0].first - loc.first;
+                    dy = path[0].second - loc.second;
+                }
+                else
+                {
+                    walking_ = false;
+                }
+            }
+
+            if (dx != 0 || dy != 0)
+            {
                 the_game_->player_act(dx, dy, player::act_move);
+                // The player's part is done, so the world can take its
+                // turn while the move plays out.
+                if (player_moving_)
+                    the_game_->begin_rest_act();
+                else
+                    walking_ = false;
+            }
         }
 
         // Player turn happening, update shit.
@@ -93,15 +128,14 @@ public:
             player_timer_ += dt;
             if (player_timer_ >= turn_length_s / 2.0)
             {
-                attacking_ = weak_ptr();
-                missing_ = weak_ptr();
+                attacking_ = handle();
             }
 
             if (player_timer_ >= turn_length_s)
             {
                 player_coord_ = player_destination_;
                 player_moving_ = false;
-                the_game_->rest_act();
+                the_game_->finish_rest_act();
             }
             else
             {
@@ -114,7 +148,7 @@ public:
         player_anim_.update(dt);
     }
 
-    virtual void player_did(entity::did did, weak_ptr targ)
+    virtual void player_did(entity::did did, handle targ)
     {
         auto loc = the_game_->player_coord();
         if (did == entity::did_move)
@@ -130,8 +164,6 @@ public:
         {
             if (did == entity::did_attack)
                 attacking_ = targ;
-            else
-                missing_ = targ;
             player_destination_ = {loc.first * tile_size, loc.second * tile_size};
             player_delta_ = player_destination_ - player_coord_;
             player_moving_ = true;
@@ -140,15 +172,17 @@ public:
         }
     }
 
-    weak_const_ptr get_attacking() const { return attacking_; }
-    weak_const_ptr get_missing() const { return missing_; }
+    handle get_attacking() const { return attacking_; }
 
 protected:
     the_game *the_game_;
     resource_manager *sprite_manager_;
     state_animator player_anim_;
-    weak_ptr attacking_;
-    weak_ptr missing_;
+    handle attacking_;
+
+    // Click to move.
+    bool walking_;
+    std::pair<int, int> walk_goal_;
 
     // Smooth scrolling.
     bool player_moving_;
@@ -160,10 +194,27 @@ protected:
 
 class the_game_renderer
 {
+private:
+    // Tiles drawn past the edges of the view, for anything sliding in.
+    static constexpr int view_margin = 1;
+    // Width and height of a cached piece of terrain, in tiles.
+    static constexpr int chunk_tiles = 8;
+    // Chunks kept past the edges of the view, in chunks. Anything farther
+    // out is let go and drawn again if it comes back.
+    static constexpr int chunk_margin = 1;
 public:
     the_game_renderer(const resource_manager *sm, const the_game *tg, const player_controller *controller) :
-        sprite_manager_(sm), the_game_(tg), controller_(controller)
+        sprite_manager_(sm), the_game_(tg), controller_(controller),
+        terrain_version_(0), chunks_wide_(0), uncached_(false)
     {
+        // Looked up once, so drawing doesn't hash any strings. The level's
+        // sprites are few enough to all be on one page.
+        atlas_ = &sprite_manager_->acquire<texture_atlas>("atlas");
+        texture_ = &atlas_->get_texture(atlas_->get_page("floor"));
+        floor_rect_ = atlas_->get_rect("floor");
+        rocks_rect_ = atlas_->get_rect("rocks");
+        for (int type = pt_none + 1; type < pt_count; ++type)
+            plant_rects_[type] = atlas_->get_rect(plant_archetypes[type].name);
     }
     virtual ~the_game_renderer() { }
 
@@ -172,67 +223,213 @@ public:
         (void)dt;
     }
 
-    virtual void render(sf::RenderWindow *win, const sf::Transform &trans=sf::Transform()) const
+    // The terrain comes out of cached chunks, one quad each, and whatever
+    // stands on it is one batch from the atlas. Only the tiles in win's
+    // view are looked at.
+    virtual void render(sf::RenderTarget *win, const sf::Transform &trans=sf::Transform()) const
+    {
+        // Mid-turn this is the game as it was when the turn started.
+        const the_game &game = the_game_->get_view();
+        const region &reg = game.get_region();
+        auto seen = visible_tiles(*win, trans, reg);
+
+        sf::RenderStates states(texture_);
+        states.transform = trans;
+        draw_terrain(win, states, reg, seen);
+
+        // Plants, picked out of the map tile by tile.
+        batch_.begin(texture_);
+        const plant_store &plants = game.get_plants();
+        for (int x = seen.left; x < seen.left + seen.width; ++x)
+        {
+            for (int y = seen.top; y < seen.top + seen.height; ++y)
+            {
+                auto pl = game.get_entity_at(x, y);
+                auto type = plants.get_type(pl);
+                if (type == pt_none)
+                    continue;
+
+                auto tint = sf::Color::White;
+                if (pl == controller_->get_attacking())
+                    tint = sf::Color(255, 0, 0, 255);
+                batch_.add(plant_rects_[type], tile_position(x, y), tile_extent(), tint);
+            }
+        }
+
+        batch_.add(atlas_->get_rect(controller_->get_animator().get_texture()), controller_->get_coord(), tile_extent());
+        batch_.flush(*win, states);
+    }
+protected:
+    // The tiles never change during a level, so each chunk of them is drawn
+    // into a texture of its own when it's seen, and kept while it stays
+    // within chunk_margin of the view. They're all thrown out when the
+    // region's version changes. Without render textures
+    // it falls back on drawing the seen tiles from the atlas every frame.
+    void draw_terrain(sf::RenderTarget *win, const sf::RenderStates &states, const region &reg, const sf::IntRect &seen) const
+    {
+        if (reg.get_version() != terrain_version_)
+        {
+            terrain_version_ = reg.get_version();
+            chunks_wide_ = (reg.get_width() + chunk_tiles - 1) / chunk_tiles;
+            size_t high = (reg.get_height() + chunk_tiles - 1) / chunk_tiles;
+            terrain_chunks_.clear();
+            terrain_chunks_.resize(chunks_wide_ * high);
+            live_chunks_.clear();
+        }
+
+        if (seen.width == 0 || seen.height == 0)
+            return;
+
+        if (uncached_)
+        {
+            batch_.begin(texture_);
+            add_tiles(reg, seen);
+            batch_.flush(*win, states);
+            return;
+        }
+
+        int left = seen.left / chunk_tiles, right = (seen.left + seen.width - 1) / chunk_tiles;
+        int top = seen.top / chunk_tiles, bottom = (seen.top + seen.height - 1) / chunk_tiles;
+        evict_chunks(left - chunk_margin, top - chunk_margin, right + chunk_margin, bottom + chunk_margin);
+
+        float size = chunk_tiles * tile_size;
+        for (int cy = top; cy <= bottom; ++cy)
+        {
+            for (int cx = left; cx <= right; ++cx)
+            {
+                auto &chunk = terrain_chunks_[cy * chunks_wide_ + cx];
+                if (!chunk)
+                {
+                    chunk = draw_chunk(reg, cx, cy);
+                    if (!chunk)
+                    {
+                        uncached_ = true;
+                        draw_terrain(win, states, reg, seen);
+                        return;
+                    }
+                    live_chunks_.push_back(cy * chunks_wide_ + cx);
+                }
+
+                float x = cx * size, y = cy * size;
+                float px = chunk->getSize().x;
+                sf::Vertex quad[4] = {
+                    sf::Vertex(sf::Vector2f(x, y), sf::Vector2f(0, 0)),
+                    sf::Vertex(sf::Vector2f(x + size, y), sf::Vector2f(px, 0)),
+                    sf::Vertex(sf::Vector2f(x + size, y + size), sf::Vector2f(px, px)),
+                    sf::Vertex(sf::Vector2f(x, y + size), sf::Vector2f(0, px)),
+                };
+                sf::RenderStates chunk_states(states);
+                chunk_states.texture = &chunk->getTexture();
+                win->draw(quad, 4, sf::Quads, chunk_states);
+            }
+        }
+    }
+
+    // Drops every chunk outside of left..right x top..bottom, in chunks.
+    void evict_chunks(int left, int top, int right, int bottom) const
     {
-        const region &reg = the_game_->get_region();
+        size_t kept = 0;
+        for (size_t i = 0; i < live_chunks_.size(); ++i)
+        {
+            auto index = live_chunks_[i];
+            int cx = index % chunks_wide_, cy = index / chunks_wide_;
+            if (cx >= left && cx <= right && cy >= top && cy <= bottom)
+                live_chunks_[kept++] = index;
+            else
+                terrain_chunks_[index].reset();
+        }
+        live_chunks_.resize(kept);
+    }
 
-        for (size_t x = 0; x < reg.get_width(); ++x)
+    // Null if there's no render texture to be had.
+    std::unique_ptr<sf::RenderTexture> draw_chunk(const region &reg, int cx, int cy) const
+    {
+        unsigned px = chunk_tiles * (unsigned)floor_rect_.width;
+        std::unique_ptr<sf::RenderTexture> chunk(new sf::RenderTexture());
+        if (!chunk->create(px, px))
+            return nullptr;
+
+        float size = chunk_tiles * tile_size;
+        chunk->setView(sf::View(sf::FloatRect(cx * size, cy * size, size, size)));
+        chunk->clear(sf::Color::Transparent);
+        batch_.begin(texture_);
+        auto tiles = sf::IntRect(cx * chunk_tiles, cy * chunk_tiles,
+            std::min<int>(static_cast<int>(chunk_tiles), reg.get_width() - cx * chunk_tiles),
+            std::min<int>(static_cast<int>(chunk_tiles), reg.get_height() - cy * chunk_tiles));
+        add_tiles(reg, tiles);
+        batch_.flush(*chunk);
+        chunk->display();
+        return chunk;
+    }
+
+    void add_tiles(const region &reg, const sf::IntRect &tiles) const
+    {
+        for (int x = tiles.left; x < tiles.left + tiles.width; ++x)
         {
-            for (size_t y = 0; y < reg.get_height(); ++y)
+            for (int y = tiles.top; y < tiles.top + tiles.height; ++y)
             {
-                sf::Transform t;
-                t.translate(x * tile_size, y * tile_size);
-                t.combine(trans);
-                win->draw(sprite_manager_->acquire<sf::RectangleShape>("floor"), t);
+                batch_.add(floor_rect_, tile_position(x, y), tile_extent());
                 switch (reg.tile_at(x, y))
                 {
                     case t_rocks:
-                        win->draw(sprite_manager_->acquire<sf::RectangleShape>("rocks"), t);
+                        batch_.add(rocks_rect_, tile_position(x, y), tile_extent());
                         break;
 
                     default:
                         break;
                 }
-
-                // Render plants.
-                auto pl = the_game_->get_entity_at(x, y);
-                if (pl.lock())
-                {
-                    std::string sprite = "";
-                    if (auto sptr = std::dynamic_pointer_cast<plant>(pl.lock()))
-                    {
-                        sprite = sptr->get_type();
-                    }
-
-                    if (sprite != "")
-                    {
-                        auto temp = sprite_manager_->acquire<sf::RectangleShape>(sprite);
-                        if (pl.lock() == controller_->get_attacking().lock())
-                            temp.setFillColor(sf::Color(255, 0, 0, 255));
-                        else if (pl.lock() == controller_->get_missing().lock())
-                            temp.setFillColor(sf::Color(255, 255, 255, 255));
-
-                        win->draw(temp, t);
-                    }
-                }
             }
         }
+    }
 
-        sf::Transform t;
-        t.translate(controller_->get_coord());
-        t.combine(trans);
-        win->draw(sprite_manager_->acquire<sf::RectangleShape>(controller_->get_animator().get_texture()), t);
+    // The tiles win's view shows once trans is applied, plus the margin,
+    // clipped to the region.
+    static sf::IntRect visible_tiles(const sf::RenderTarget &win, const sf::Transform &trans, const region &reg)
+    {
+        const sf::View &view = win.getView();
+        auto corner = view.getCenter() - view.getSize() * 0.5f;
+        auto seen = trans.getInverse().transformRect(sf::FloatRect(corner.x, corner.y, view.getSize().x, view.getSize().y));
+
+        int x0 = std::max(0, (int)std::floor(seen.left / tile_size) - view_margin);
+        int y0 = std::max(0, (int)std::floor(seen.top / tile_size) - view_margin);
+        int x1 = std::min((int)reg.get_width(), (int)std::ceil((seen.left + seen.width) / tile_size) + view_margin);
+        int y1 = std::min((int)reg.get_height(), (int)std::ceil((seen.top + seen.height) / tile_size) + view_margin);
+        return sf::IntRect(x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0));
     }
-protected:
+
+    static sf::Vector2f tile_position(int x, int y) { return sf::Vector2f(x * tile_size, y * tile_size); }
+    static sf::Vector2f tile_extent() { return sf::Vector2f(tile_size, tile_size); }
+
     const resource_manager *sprite_manager_;
     const the_game *the_game_;
     const player_controller *controller_;
+
+    const texture_atlas *atlas_;
+    const sf::Texture *texture_;
+    sf::FloatRect floor_rect_;
+    sf::FloatRect rocks_rect_;
+    sf::FloatRect plant_rects_[pt_count];
+
+    // Refilled for every draw, kept around so it doesn't reallocate.
+    mutable sprite_batch batch_;
+
+    // Null until seen, and again once evicted.
+    mutable std::vector<std::unique_ptr<sf::RenderTexture>> terrain_chunks_;
+    // Which of terrain_chunks_ are drawn, so eviction doesn't look at the
+    // rest.
+    mutable std::vector<size_t> live_chunks_;
+    mutable unsigned terrain_version_;
+    mutable size_t chunks_wide_;
+    // No render textures, so no chunks.
+    mutable bool uncached_;
 };
 
 static inline void manage_sprite(resource_manager &sm, const resource_manager &rm, std::string key, double width, double height)
 {
+    const texture_atlas &atlas = rm.acquire<texture_atlas>("atlas");
     sf::RectangleShape sprite({width, height});
-    sprite.setTexture(&rm.acquire<sf::Texture>(key));
+    sprite.setTexture(&atlas.get_texture(atlas.get_page(key)));
+    sprite.setTextureRect(sf::IntRect(atlas.get_rect(key)));
     sm.manage<sf::RectangleShape>(key, sprite);
 }
 
@@ -252,16 +449,6 @@ public:
         manage_sprite(sprite_manager_, *resource_manager_, "noheart", 0.1, 0.1);
         manage_sprite(sprite_manager_, *resource_manager_, "noenergy", 0.1, 0.1);
 
-        manage_sprite(sprite_manager_, *resource_manager_, "root", tile_size, tile_size);
-        manage_sprite(sprite_manager_, *resource_manager_, "vine", tile_size, tile_size);
-        manage_sprite(sprite_manager_, *resource_manager_, "seed", tile_size, tile_size);
-        manage_sprite(sprite_manager_, *resource_manager_, "player", tile_size, tile_size);
-        manage_sprite(sprite_manager_, *resource_manager_, "player_sw1", tile_size, tile_size);
-        manage_sprite(sprite_manager_, *resource_manager_, "player_sw2", tile_size, tile_size);
-        manage_sprite(sprite_manager_, *resource_manager_, "player_sa", tile_size, tile_size);
-
-        manage_sprite(sprite_manager_, *resource_manager_, "floor", tile_size, tile_size);
-        manage_sprite(sprite_manager_, *resource_manager_, "rocks", tile_size, tile_size);
 
         state_animator animator;
         animator.set_state("walking_s");
@@ -286,7 +473,7 @@ public:
         using std::placeholders::_3;
         the_game_.reset(new the_game(std::bind(&game_screen::on_did, std::ref(*this), _1, _2, _3)));
         controller_.reset(new player_controller(the_game_.get(), &sprite_manager_));
-        the_game_renderer_.reset(new the_game_renderer(&sprite_manager_, the_game_.get(), controller_.get()));
+        the_game_renderer_.reset(new the_game_renderer(resource_manager_, the_game_.get(), controller_.get()));
     }
 
     virtual ~game_screen() { }
@@ -309,7 +496,18 @@ public:
 
     virtual void on_event(const sf::Event &event)
     {
-        (void)event;
+        // Clicking a tile walks there.
+        if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Left)
+        {
+            auto size = win_->getSize();
+            float x = event.mouseButton.x / (float)size.x;
+            float y = event.mouseButton.y / (float)size.y;
+            if (!game_view_.getViewport().contains(x, y))
+                return;
+
+            auto pos = win_->mapPixelToCoords(sf::Vector2i(event.mouseButton.x, event.mouseButton.y), game_view_);
+            controller_->walk_to({(int)std::floor(pos.x / tile_size), (int)std::floor(pos.y / tile_size)});
+        }
     }
 
     virtual void on_update(double dt)
@@ -320,7 +518,7 @@ public:
             controller_->get_coord().y + tile_size / 2);
         the_game_renderer_->update(dt);
 
-        if (the_game_->get_player().is_dead())
+        if (the_game_->get_view().get_player().is_dead())
         {
             auto screen = std::make_shared<death_screen>(win_, screen_manager_, resource_manager_);
             screen_manager_->replace_screen(screen);
@@ -333,7 +531,7 @@ public:
         the_game_renderer_->render(win_);
         win_->setView(hud_view_);
 
-        auto vitals = the_game_->get_player().get_vitals();
+        auto vitals = the_game_->get_view().get_player().get_vitals();
         for (ssize_t i = 0; i < vitals.max_hearts; ++i)
         {
             sf::Transform trans;
@@ -343,7 +541,7 @@ public:
             else
                 win_->draw(sprite_manager_.acquire<sf::RectangleShape>("heart"), trans);
         }
-        auto atts = the_game_->get_player().get_attributes();
+        auto atts = the_game_->get_view().get_player().get_attributes();
         for (ssize_t i = 0; i < atts.max_energy; ++i)
         {
             sf::Transform trans;
@@ -355,13 +553,10 @@ public:
         }
     }
 
-    virtual void on_did(std::weak_ptr<entity> src, entity::did did, std::weak_ptr<entity> targ)
+    virtual void on_did(handle src, entity::did did, handle targ)
     {
-        if (auto sptr = src.lock())
-        {
-            if (sptr.get() == &the_game_->get_player())
-                controller_->player_did(did, targ);
-        }
+        if (src == the_game_->get_player_handle())
+            controller_->player_did(did, targ);
     }
 
 protected:
@@ -0,0 +1,57 @@
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <the_game.hpp>
+
+// Plays the game with no window: the player wanders at random and a new
+// game starts whenever it dies or the level runs out of plants. Prints how
+// fast turns went to stderr.
+//
+//   bilebio_headless [turns] [seed]
+// The player only ever moves straight up, down, left or right.
+static const int moves[4][2] = {{0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+
+int main(int argc, char **argv)
+{
+    long turns = argc > 1 ? std::atol(argv[1]) : 10000;
+    size_t seed = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1;
+
+    long events = 0;
+    long deaths = 0;
+    long games = 1;
+
+    rng bot(seed);
+    std::unique_ptr<the_game> game(new the_game(nullptr, seed));
+    std::vector<turn_action> script(100);
+
+    auto start = std::chrono::steady_clock::now();
+    for (long turn = 0; turn < turns; )
+    {
+        if (game->get_player().is_dead() || game->get_plants().size() == 0)
+        {
+            if (game->get_player().is_dead())
+                ++deaths;
+            game.reset(new the_game(nullptr, seed + games++));
+        }
+
+        for (auto &a : script)
+        {
+            auto &m = moves[bot.get_range(0, 3)];
+            a = {m[0], m[1], player::act_move};
+        }
+        auto sum = game->step(std::min<long>(script.size(), turns - turn), script);
+        turn += sum.turns;
+        for (int did = 0; did < entity::did_count; ++did)
+            events += sum.by_player[did] + sum.by_plants[did];
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double secs = std::chrono::duration<double>(end - start).count();
+    std::fprintf(stderr, "%ld turns in %.3fs (%.0f turns/s), %ld events, %ld games, %ld deaths, %zu plants\n",
+        turns, secs, turns / secs, events, games, deaths, game->get_plants().size());
+    return 0;
+}
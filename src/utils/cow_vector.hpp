@@ -0,0 +1,132 @@
+
+#ifndef COW_VECTOR_HPP
+#define COW_VECTOR_HPP
+
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+// A vector split into fixed size pages that copies share. Copying one only
+// copies the page pointers, and a page is copied the first time one of the
+// copies writes to it, so a copy costs about as much as what changes in it.
+//
+// Anything reached through a non-const cow_vector counts as a write. Two
+// threads can write to different elements of one cow_vector once the pages
+// they write to have been unshare()d, as long as everything else they read
+// is read through a const one.
+template <class T, size_t PageBits=6>
+class cow_vector
+{
+public:
+    static constexpr size_t page_size = 1 << PageBits;
+
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T *;
+        using reference = const T &;
+
+        const_iterator() : vec_(nullptr), i_(0) { }
+        const_iterator(const cow_vector *vec, size_t i) : vec_(vec), i_(i) { }
+
+        const T &operator*() const { return (*vec_)[i_]; }
+        const T *operator->() const { return &(*vec_)[i_]; }
+        const T &operator[](difference_type n) const { return (*vec_)[i_ + n]; }
+
+        const_iterator &operator++() { ++i_; return *this; }
+        const_iterator operator++(int) { auto it = *this; ++i_; return it; }
+        const_iterator &operator--() { --i_; return *this; }
+        const_iterator operator--(int) { auto it = *this; --i_; return it; }
+        const_iterator &operator+=(difference_type n) { i_ += n; return *this; }
+        const_iterator &operator-=(difference_type n) { i_ -= n; return *this; }
+        const_iterator operator+(difference_type n) const { return const_iterator(vec_, i_ + n); }
+        const_iterator operator-(difference_type n) const { return const_iterator(vec_, i_ - n); }
+        friend const_iterator operator+(difference_type n, const const_iterator &it) { return it + n; }
+        difference_type operator-(const const_iterator &it) const { return i_ - it.i_; }
+
+        bool operator==(const const_iterator &it) const { return i_ == it.i_; }
+        bool operator!=(const const_iterator &it) const { return i_ != it.i_; }
+        bool operator<(const const_iterator &it) const { return i_ < it.i_; }
+        bool operator>(const const_iterator &it) const { return i_ > it.i_; }
+        bool operator<=(const const_iterator &it) const { return i_ <= it.i_; }
+        bool operator>=(const const_iterator &it) const { return i_ >= it.i_; }
+
+    private:
+        const cow_vector *vec_;
+        size_t i_;
+    };
+
+    cow_vector() : size_(0) { }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    const T &operator[](size_t i) const { return (*pages_[i >> PageBits])[i & mask]; }
+    T &operator[](size_t i) { return own(i >> PageBits)[i & mask]; }
+
+    const T &back() const { return (*this)[size_ - 1]; }
+    T &back() { return (*this)[size_ - 1]; }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size_); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    void push_back(const T &v)
+    {
+        if (size_ == pages_.size() * page_size)
+            pages_.push_back(std::make_shared<page>());
+        (*this)[size_++] = v;
+    }
+
+    // Whatever was in the last element is left in its page.
+    void pop_back() { --size_; }
+
+    // Keeps the pages around, a cleared vector doesn't allocate until it
+    // grows past where it was.
+    void clear() { size_ = 0; }
+
+    void resize(size_t n, const T &v=T())
+    {
+        while (pages_.size() * page_size < n)
+            pages_.push_back(std::make_shared<page>());
+        for (size_t i = size_; i < n; ++i)
+            (*this)[i] = v;
+        size_ = n;
+    }
+
+    void assign(size_t n, const T &v)
+    {
+        pages_.clear();
+        size_ = 0;
+        resize(n, v);
+    }
+
+    // Pages are only allocated on demand, so there's nothing to reserve.
+    void reserve(size_t n) { (void)n; }
+
+    // Gives this vector its own copy of the page element i is on.
+    void unshare(size_t i) { own(i >> PageBits); }
+
+private:
+    using page = std::array<T, page_size>;
+    static constexpr size_t mask = page_size - 1;
+
+    page &own(size_t k)
+    {
+        auto &p = pages_[k];
+        if (p.use_count() > 1)
+            p = std::make_shared<page>(*p);
+        return *p;
+    }
+
+    std::vector<std::shared_ptr<page>> pages_;
+    size_t size_;
+};
+
+#endif
@@ -0,0 +1,57 @@
+
+#ifndef SPRITE_BATCH_HPP
+#define SPRITE_BATCH_HPP
+
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+// Sprites cut from one texture, queued up as quads and drawn with a single
+// draw call. The vertices are kept between flushes, so once the batch has
+// grown to a frame's worth of sprites it never allocates again.
+class sprite_batch
+{
+public:
+    sprite_batch() : texture_(nullptr), used_(0) { }
+
+    // Drops anything queued and starts over with texture.
+    void begin(const sf::Texture *texture)
+    {
+        texture_ = texture;
+        used_ = 0;
+    }
+
+    // rect is in texture coordinates, position and size in world ones.
+    void add(const sf::FloatRect &rect, sf::Vector2f position, sf::Vector2f size, sf::Color tint=sf::Color::White)
+    {
+        if (used_ + 4 > vertices_.size())
+            vertices_.resize(used_ + 4);
+
+        sf::Vertex *v = &vertices_[used_];
+        v[0] = sf::Vertex(position, tint, sf::Vector2f(rect.left, rect.top));
+        v[1] = sf::Vertex(sf::Vector2f(position.x + size.x, position.y), tint, sf::Vector2f(rect.left + rect.width, rect.top));
+        v[2] = sf::Vertex(sf::Vector2f(position.x + size.x, position.y + size.y), tint, sf::Vector2f(rect.left + rect.width, rect.top + rect.height));
+        v[3] = sf::Vertex(sf::Vector2f(position.x, position.y + size.y), tint, sf::Vector2f(rect.left, rect.top + rect.height));
+        used_ += 4;
+    }
+
+    size_t size() const { return used_ / 4; }
+
+    // Draws everything queued since begin() and empties the batch.
+    void flush(sf::RenderTarget &target, sf::RenderStates states=sf::RenderStates::Default)
+    {
+        if (used_ > 0)
+        {
+            states.texture = texture_;
+            target.draw(&vertices_[0], used_, sf::Quads, states);
+        }
+        used_ = 0;
+    }
+
+private:
+    const sf::Texture *texture_;
+    std::vector<sf::Vertex> vertices_;
+    size_t used_;
+};
+
+#endif
@@ -0,0 +1,162 @@
+
+#ifndef TEXTURE_ATLAS_HPP
+#define TEXTURE_ATLAS_HPP
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+// Sprites packed into as few textures as will hold them, so everything
+// drawn from one page can go in one vertex array and one draw. Sprites are
+// looked up by name and come back as the page they're on and a rectangle
+// in its texture coordinates.
+//
+// Sprites are added as images (or parts of them), packed into shelves,
+// tallest first, by build(), and uploaded.
+class texture_atlas
+{
+private:
+    // Empty pixels between sprites.
+    static constexpr unsigned padding = 1;
+public:
+    texture_atlas() { }
+
+    // rect is the part of image to use, all of it if empty.
+    void add(const std::string &key, const sf::Image &image, const sf::IntRect &rect=sf::IntRect())
+    {
+        images_.push_back(image);
+        pending_.push_back({key, images_.size() - 1, whole(image, rect)});
+    }
+
+    // Each file is only read once, however many sprites come out of it.
+    bool add_file(const std::string &key, const std::string &filename, const sf::IntRect &rect=sf::IntRect())
+    {
+        auto it = files_.find(filename);
+        if (it == files_.end())
+        {
+            sf::Image image;
+            if (!image.loadFromFile(filename))
+                return false;
+            images_.push_back(image);
+            it = files_.insert({filename, images_.size() - 1}).first;
+        }
+        pending_.push_back({key, it->second, whole(images_[it->second], rect)});
+        return true;
+    }
+
+    // Packs everything added so far onto pages of at most max_size x
+    // max_size and uploads them. Fails if a sprite doesn't fit on a page,
+    // or a texture can't be made.
+    bool build(unsigned max_size=2048)
+    {
+        std::vector<size_t> order(pending_.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+        {
+            return pending_[a].rect.height > pending_[b].rect.height;
+        });
+
+        // Left to right along a shelf, a new shelf when that runs out and
+        // a new page when the shelves do.
+        std::vector<sf::Vector2u> extents(1);
+        std::vector<sf::Vector2u> spots(pending_.size());
+        std::vector<size_t> pages(pending_.size());
+        unsigned x = 0, y = 0, shelf = 0;
+        for (auto i : order)
+        {
+            unsigned w = pending_[i].rect.width + padding;
+            unsigned h = pending_[i].rect.height + padding;
+            if (w > max_size || h > max_size)
+                return false;
+            if (x + w > max_size)
+            {
+                y += shelf;
+                x = 0;
+                shelf = 0;
+            }
+            if (y + h > max_size)
+            {
+                extents.push_back(sf::Vector2u());
+                x = y = shelf = 0;
+            }
+
+            pages[i] = extents.size() - 1;
+            spots[i] = sf::Vector2u(x, y);
+            x += w;
+            shelf = std::max(shelf, h);
+            auto &ext = extents.back();
+            ext = sf::Vector2u(std::max(ext.x, x), std::max(ext.y, y + h));
+        }
+
+        std::vector<sf::Image> sheets(extents.size());
+        for (size_t p = 0; p < sheets.size(); ++p)
+            sheets[p].create(std::max(1u, extents[p].x), std::max(1u, extents[p].y), sf::Color::Transparent);
+
+        for (size_t i = 0; i < pending_.size(); ++i)
+        {
+            auto &s = pending_[i];
+            sheets[pages[i]].copy(images_[s.image], spots[i].x, spots[i].y, s.rect);
+            regions_[s.key] = {pages[i], sf::FloatRect(spots[i].x, spots[i].y, s.rect.width, s.rect.height)};
+        }
+
+        textures_.resize(sheets.size());
+        for (size_t p = 0; p < sheets.size(); ++p)
+            if (!textures_[p].loadFromImage(sheets[p]))
+                return false;
+
+        pending_.clear();
+        images_.clear();
+        files_.clear();
+        return true;
+    }
+
+    size_t get_page_count() const { return textures_.size(); }
+    const sf::Texture &get_texture(size_t page=0) const { return textures_.at(page); }
+
+    size_t get_page(const std::string &key) const { return find(key).page; }
+    const sf::FloatRect &get_rect(const std::string &key) const { return find(key).rect; }
+
+private:
+    struct sprite
+    {
+        std::string key;
+        size_t image;
+        sf::IntRect rect;
+    };
+
+    struct placed
+    {
+        size_t page;
+        sf::FloatRect rect;
+    };
+
+    static sf::IntRect whole(const sf::Image &image, const sf::IntRect &rect)
+    {
+        if (rect.width > 0 && rect.height > 0)
+            return rect;
+        return sf::IntRect(0, 0, image.getSize().x, image.getSize().y);
+    }
+
+    const placed &find(const std::string &key) const
+    {
+        auto it = regions_.find(key);
+        if (it == regions_.end())
+            throw std::out_of_range("texture_atlas");
+        return it->second;
+    }
+
+    std::vector<sf::Texture> textures_;
+    std::unordered_map<std::string, placed> regions_;
+
+    // Waiting on build().
+    std::vector<sprite> pending_;
+    std::vector<sf::Image> images_;
+    std::unordered_map<std::string, size_t> files_;
+};
+
+#endif
@@ -0,0 +1,162 @@
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+// Runs batches of numbered tasks. Every thread (the caller included) has its
+// own queue and takes from the back of it, and once that's empty it steals
+// from the front of the others, so a few slow tasks don't hold up a batch.
+//
+// With no workers everything runs on the caller, in order.
+class thread_pool : private boost::noncopyable
+{
+public:
+    thread_pool(size_t workers=default_workers()) :
+        pending_(0), generation_(0), stop_(false), job_(nullptr)
+    {
+        for (size_t i = 0; i < workers + 1; ++i)
+            queues_.emplace_back(new queue());
+        for (size_t i = 0; i < workers; ++i)
+            threads_.emplace_back([this, i] { work_loop(i + 1); });
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto &t : threads_)
+            t.join();
+    }
+
+    size_t get_workers() const { return threads_.size(); }
+
+    // Calls fn(i) for every i in [0, n) and returns once all of them have.
+    // Which thread runs which task isn't fixed, so tasks must only write to
+    // things no other task touches.
+    void run(size_t n, const std::function<void(size_t)> &fn)
+    {
+        if (threads_.empty() || n < 2)
+        {
+            for (size_t i = 0; i < n; ++i)
+                fn(i);
+            return;
+        }
+
+        job_ = &fn;
+        pending_ = n;
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto &q = *queues_[i % queues_.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(i);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++generation_;
+        }
+        wake_.notify_all();
+
+        work(0);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
+    }
+
+    static size_t default_workers()
+    {
+        auto n = std::thread::hardware_concurrency();
+        return n > 1 ? n - 1 : 0;
+    }
+
+private:
+    struct queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    bool pop(size_t self, size_t &task)
+    {
+        auto &q = *queues_[self];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty())
+            return false;
+        task = q.tasks.back();
+        q.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t self, size_t &task)
+    {
+        for (size_t i = 1; i < queues_.size(); ++i)
+        {
+            auto &q = *queues_[(self + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty())
+            {
+                task = q.tasks.front();
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t self)
+    {
+        size_t task;
+        while (pop(self, task) || steal(self, task))
+        {
+            (*job_)(task);
+            if (--pending_ == 0)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                done_.notify_all();
+            }
+        }
+    }
+
+    void work_loop(size_t self)
+    {
+        size_t seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+                if (stop_)
+                    return;
+                seen = generation_;
+            }
+            work(self);
+        }
+    }
+
+    // Slot 0 belongs to whoever calls run().
+    std::vector<std::unique_ptr<queue>> queues_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::atomic<size_t> pending_;
+    size_t generation_;
+    bool stop_;
+    const std::function<void(size_t)> *job_;
+};
+
+#endif